@@ -33,6 +33,8 @@ for i in $(seq 1 $numTests); do
 	echo -n "# $i ... "; 
 
 	logTestFile="$logTestsDir"/log$i.txt
+	# files are copied by a pool of threads (--mode=pool is the default),
+	# add --mode=per-file to get a thread per file as it used to be
 	./build/source/memory_manager_test $use_ram_size > "$logTestFile" && 
 	./check_result.sh >> "$logTestFile" 
 
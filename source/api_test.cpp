@@ -0,0 +1,367 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "memory_manager/block_streambuf.hpp"
+#include "memory_manager/memory_manager.hpp"
+#include "memory_manager/pin_set.hpp"
+#include "memory_manager/swappable_vector.hpp"
+
+namespace fs = std::filesystem;
+
+//---------------------------------------------------------------
+// Behaviour checks of the block API: every check uses its own small
+// manager (126 frames of 4096 bytes), so a few hundred blocks are
+// enough to push the first ones out to swap. Swap files are kept in
+// a temporary folder which is removed at the end.
+//---------------------------------------------------------------
+static const size_t MEMORY_SIZE = 1024 * 1024;
+static const size_t FRAME_SIZE = 4096;
+static const size_t NUM_BLOCKS = 300; // more than fits into MEMORY_SIZE
+
+static fs::path swapDir;
+
+static SwapConfig TestSwap(const std::string &name, bool persistent) {
+    SwapConfig config;
+    config.dir = swapDir / name;
+    config.persistent = persistent;
+    return config;
+}
+
+static void Fill(MemoryBlock &block, char value) {
+    std::memset(block.data(), value, block.size());
+}
+
+static bool Holds(const MemoryBlock &block, char value, size_t size = 0) {
+    auto data = block.data();
+    const char *begin = data;
+    const char *end = begin + (size != 0 ? size : block.size());
+    return std::all_of(begin, end, [value](char c) { return c == value; });
+}
+
+static char Pattern(size_t i) { return static_cast<char>('a' + i % 26); }
+
+// Blocks of one frame each, filled with Pattern(i), the first ones are
+// swapped out when they are all allocated
+static std::vector<MemoryBlock> FillPool(MemoryManager &manager) {
+    std::vector<MemoryBlock> blocks;
+    for (size_t i = 0; i < NUM_BLOCKS; ++i) {
+        blocks.push_back(manager.getBlock(FRAME_SIZE));
+        Fill(blocks.back(), Pattern(i));
+    }
+    return blocks;
+}
+
+static void FreeAll(std::vector<MemoryBlock> &blocks) {
+    for (MemoryBlock &block : blocks) {
+        block.free();
+    }
+    blocks.clear();
+}
+
+//------------------------------
+// Checks
+//------------------------------
+static bool CloneThenWrite() {
+    MemoryManager manager(MEMORY_SIZE, TestSwap("clone", false));
+    MemoryBlock block = manager.getBlock(100);
+    Fill(block, 'a');
+    MemoryBlock copy = manager.clone(block);
+    Fill(copy, 'c');
+    bool ok = Holds(block, 'a') && Holds(copy, 'c');
+    Fill(block, 'b');
+    ok = ok && Holds(block, 'b') && Holds(copy, 'c');
+    copy.free();
+    block.free();
+    return ok;
+}
+
+static bool CloneSwappedOut() {
+    MemoryManager manager(MEMORY_SIZE, TestSwap("swapped", false));
+    std::vector<MemoryBlock> blocks = FillPool(manager);
+    // the first block is in swap now
+    MemoryBlock copy = manager.clone(blocks.front());
+    Fill(copy, '#');
+    bool ok = Holds(copy, '#') && Holds(blocks.front(), Pattern(0));
+    Fill(blocks.front(), '$');
+    ok = ok && Holds(copy, '#') && Holds(blocks.front(), '$');
+    for (size_t i = 1; i < blocks.size(); ++i) {
+        ok = ok && Holds(blocks[i], Pattern(i));
+    }
+    copy.free();
+    FreeAll(blocks);
+    return ok;
+}
+
+static bool CloneLocked() {
+    MemoryManager manager(MEMORY_SIZE, TestSwap("locked", false));
+    MemoryBlock block = manager.getBlock(FRAME_SIZE);
+    block.lock();
+    char *data = block.data();
+    std::memset(data, 'a', block.size());
+    MemoryBlock copy = manager.clone(block);
+    // the caller's pin and pointer are kept
+    bool ok = block.isLocked() && block.data() == data;
+    Fill(copy, 'c');
+    ok = ok && Holds(block, 'a') && Holds(copy, 'c');
+    block.unlock();
+    copy.free();
+    block.free();
+    return ok;
+}
+
+static bool ReadOnlyCloneThenWrite() {
+    MemoryManager manager(MEMORY_SIZE, TestSwap("readonly", false));
+    MemoryBlock block = manager.getBlock(FRAME_SIZE);
+    Fill(block, 'a');
+    MemoryBlock copy = manager.clone(block);
+    copy.lockReadOnly();
+    bool ok = Holds(copy, 'a');
+    // the write copies the shared data, the original one is not changed
+    std::memset(copy.data(), 'c', copy.size());
+    ok = ok && copy.isLocked() && Holds(copy, 'c') && Holds(block, 'a');
+    copy.unlock();
+    copy.free();
+    block.free();
+    return ok;
+}
+
+static bool Resize() {
+    MemoryManager manager(MEMORY_SIZE, TestSwap("resize", false));
+    MemoryBlock block = manager.getBlock(100);
+    Fill(block, 'r');
+    manager.resize(block, 3000);
+    bool ok = block.size() == 3000 && Holds(block, 'r', 100);
+
+    block.lock();
+    manager.resize(block, FRAME_SIZE);
+    ok = ok && block.isLocked() && Holds(block, 'r', 100);
+    block.unlock();
+
+    // the data is taken directly from swap
+    std::vector<MemoryBlock> blocks = FillPool(manager);
+    manager.resize(blocks.front(), 10);
+    manager.resize(blocks.front(), 20);
+    ok = ok && Holds(blocks.front(), Pattern(0), 10);
+    FreeAll(blocks);
+    block.free();
+    return ok;
+}
+
+static bool AlignedBlocks() {
+    MemoryManager manager(MEMORY_SIZE, TestSwap("aligned", false));
+    bool ok = true;
+    for (size_t alignment : {size_t(1), size_t(8), ALIGN_CACHE_LINE,
+                             size_t(512), ALIGN_PAGE}) {
+        MemoryBlock block = manager.getBlock(10, alignment);
+        block.lock();
+        uintptr_t address = reinterpret_cast<uintptr_t>(
+            static_cast<char *>(block.data()));
+        ok = ok && address % alignment == 0;
+        block.unlock();
+        block.free();
+    }
+    try {
+        manager.getBlock(10, 3);
+        ok = false;
+    } catch (const std::invalid_argument &) {
+    }
+    return ok;
+}
+
+static bool StreamBuf() {
+    MemoryManager manager(MEMORY_SIZE, TestSwap("stream", false));
+    std::vector<MemoryBlock> blocks;
+    for (size_t size : {100, 4096, 7}) {
+        blocks.push_back(manager.getBlock(size));
+    }
+    std::string text;
+    for (size_t i = 0; i < 100 + 4096 + 7; ++i) {
+        text += Pattern(i * 7);
+    }
+    {
+        BlockStreamBuf buf(blocks.data(), blocks.size(), std::ios::out);
+        std::ostream out(&buf);
+        out << text;
+    }
+    bool ok = Holds(blocks[2], text.at(100 + 4096), 1);
+    std::string result;
+    {
+        BlockStreamBuf buf(blocks.data(), blocks.size(), std::ios::in);
+        std::istream in(&buf);
+        result.assign(std::istreambuf_iterator<char>(in),
+                      std::istreambuf_iterator<char>());
+        in.clear();
+        in.seekg(100);
+        ok = ok && in.get() == text.at(100);
+    }
+    FreeAll(blocks);
+    return ok && result == text;
+}
+
+static bool Pins() {
+    MemoryManager manager(MEMORY_SIZE, TestSwap("pins", false));
+    std::vector<MemoryBlock> blocks = FillPool(manager);
+    MemoryBlock &first = blocks.front(); // in swap
+    MemoryBlock &last = blocks.back();   // in ram
+    {
+        PinSet pins{&first, &last};
+        std::memcpy(last.data(), first.data(), last.size());
+    }
+    bool ok = !first.isLocked() && !last.isLocked() &&
+              Holds(last, Pattern(0)) && Holds(first, Pattern(0));
+
+    // a swapped out block which shares the ram block of a block pinned by
+    // the caller is moved to another one
+    for (size_t i = 1; i < blocks.size() && ok; ++i) {
+        if (blocks[i].handle().blockIndex != first.handle().blockIndex)
+            continue;
+        first.lock();
+        {
+            PinSet pins{&first, &blocks[i]};
+            ok = blocks[i].handle().blockIndex != first.handle().blockIndex &&
+                 Holds(blocks[i], Pattern(i)) && Holds(first, Pattern(0));
+        }
+        first.unlock();
+    }
+
+    // a read pin keeps clones shared, a write pin copies them
+    MemoryBlock copy = manager.clone(last);
+    {
+        PinSet pins({&copy}, PinSet::Policy::Relocate, PinSet::Access::Read);
+        ok = ok && Holds(copy, Pattern(0));
+    }
+    {
+        PinSet pins{&copy};
+        std::memset(copy.data(), '!', copy.size());
+    }
+    ok = ok && Holds(copy, '!') && Holds(last, Pattern(0));
+    copy.free();
+    FreeAll(blocks);
+    return ok;
+}
+
+static bool VectorCursor() {
+    MemoryManager manager(MEMORY_SIZE, TestSwap("vector", false));
+    SwappableVector<uint32_t> vector(manager);
+    const size_t size = vector.elementsPerPage() * NUM_BLOCKS;
+    for (size_t i = 0; i < size; ++i) {
+        vector.push_back(static_cast<uint32_t>(i));
+    }
+    // pages of the vector share ram blocks, other elements are accessed
+    // while the cursor pins one of them
+    bool ok = true;
+    size_t position = 0;
+    size_t other = size - 1;
+    for (uint32_t &x : vector.sequential()) {
+        if (position % 1000 == 0) {
+            // elements before the cursor are incremented already
+            uint32_t value = vector.get(other);
+            ok = ok && value == other + (other < position ? 1 : 0);
+            vector.set(other, value);
+            other = (other * 7 + 3) % size;
+        }
+        x += 1;
+        ++position;
+    }
+    for (size_t i = 0; i < size; i += 997) {
+        ok = ok && vector.at(i) == i + 1;
+    }
+    return ok;
+}
+
+static bool VectorIterators() {
+    MemoryManager manager(MEMORY_SIZE, TestSwap("iterators", false));
+    SwappableVector<uint32_t> vector(manager);
+    const size_t size = 3 * vector.elementsPerPage();
+    for (size_t i = 0; i < size; ++i) {
+        vector.push_back(static_cast<uint32_t>(i * 7919 % size));
+    }
+    std::sort(vector.begin(), vector.end());
+    bool ok = std::is_sorted(vector.cbegin(), vector.cend());
+    std::reverse(vector.begin(), vector.end());
+    *vector.begin() = vector.get(0) + 1;
+    SwappableVector<uint32_t>::const_iterator it = vector.begin() + 1;
+    return ok && vector.get(0) == size && *it == size - 2 &&
+           vector.begin()[size - 1] == 0;
+}
+
+static bool PersistentRestart() {
+    const SwapConfig config = TestSwap("persistent", true);
+    std::vector<BlockHandle> handles;
+    {
+        MemoryManager manager(MEMORY_SIZE, config);
+        std::vector<MemoryBlock> blocks = FillPool(manager);
+        for (const MemoryBlock &block : blocks) {
+            handles.push_back(block.handle());
+        }
+    } // blocks are not freed, they are saved to the swap
+
+    bool ok = true;
+    {
+        MemoryManager manager(MEMORY_SIZE, config);
+        std::vector<MemoryBlock> blocks;
+        for (size_t i = 0; i < handles.size(); ++i) {
+            blocks.push_back(manager.attach(handles[i]));
+            ok = ok && Holds(blocks.back(), Pattern(i));
+        }
+        FreeAll(blocks);
+        try {
+            manager.attach(handles.front());
+            ok = false;
+        } catch (const std::invalid_argument &) {
+        }
+    }
+    return ok;
+}
+
+int main() {
+    swapDir = fs::temp_directory_path() /
+              ("memory_manager_api_test_" + std::to_string(getpid()));
+
+    const std::vector<std::pair<std::string, std::function<bool()>>> checks =
+        {{"clone then write", CloneThenWrite},
+         {"clone of a swapped out block", CloneSwappedOut},
+         {"clone of a locked block", CloneLocked},
+         {"read-only pinned clone then write", ReadOnlyCloneThenWrite},
+         {"resize", Resize},
+         {"aligned blocks", AlignedBlocks},
+         {"BlockStreamBuf", StreamBuf},
+         {"PinSet", Pins},
+         {"SwappableVector cursor", VectorCursor},
+         {"SwappableVector iterators", VectorIterators},
+         {"persistent write, restart, attach", PersistentRestart}};
+
+    size_t failed = 0;
+    for (const auto &[name, check] : checks) {
+        bool ok = false;
+        try {
+            ok = check();
+        } catch (const std::exception &e) {
+            std::cout << name << ": " << e.what() << std::endl;
+        }
+        std::cout << (ok ? "[Ok]    " : "[ERROR] ") << name << std::endl;
+        failed += ok ? 0 : 1;
+    }
+    fs::remove_all(swapDir);
+
+    if (failed > 0) {
+        std::cout << failed << " of " << checks.size() << " checks failed"
+                  << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,649 @@
+//---------------------------------------------------------------
+// memory_manager_bench - runs the copy workload over a matrix of
+// configurations and writes one CSV line per cell.
+//
+// Cells with --api=paged copy through a PagedRegion (raw pointers and
+// userfaultfd) instead of MemoryBlock handles, to compare both ways of
+// using the manager on the same workload. Cells with --api=vector copy
+// through a SwappableVector<char> and its sequential cursor.
+//
+// With --false-sharing it measures instead how fast threads update their
+// own small blocks when neighbouring blocks belong to other threads, with
+// and without PoolConfig::isolateFrames.
+//
+// Every cell runs in a forked process with a fresh memory manager, so
+// cells don't share pools or swap files and the peak RSS of a cell is its
+// own. Input files are synthetic and generated once per file count.
+//---------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "memory_manager/memory_manager.hpp"
+#include "memory_manager/paged_region.hpp"
+#include "memory_manager/swappable_vector.hpp"
+#include "utils/utils.hpp"
+
+namespace fs = std::filesystem;
+
+// One point of the matrix
+struct Cell {
+    size_t ramMb;
+    size_t threads;
+    std::string sizes;   // uniform | small | fixed
+    size_t files;
+    std::string pattern; // sequential | random
+    std::string api;     // handles | paged | vector
+};
+
+// What a child process reports back through a pipe
+struct CellResult {
+    uint64_t wallMs;
+    uint64_t bytes;
+    uint64_t swapIns;
+    uint64_t swapOuts;
+    uint64_t pageFaults; // of paged regions
+    uint64_t ok;
+};
+
+static std::vector<std::string> SplitList(const std::string &list) {
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+static std::vector<size_t> SplitNumbers(const std::string &list) {
+    std::vector<size_t> numbers;
+    for (const std::string &item : SplitList(list))
+        numbers.push_back(std::stoul(item));
+    return numbers;
+}
+
+//------------------------------
+// Synthetic input
+//------------------------------
+static fs::path InputDir(const fs::path &workDir, size_t files,
+                         size_t dataMb) {
+    return workDir / ("input_" + std::to_string(files) + "x" +
+                      std::to_string(dataMb) + "mb");
+}
+
+// Data is split evenly between files, so cells with different file counts
+// move the same amount of bytes
+static void GenerateInput(const fs::path &dir, size_t files, size_t dataMb) {
+    if (fs::exists(dir))
+        return;
+    fs::create_directories(dir);
+    const size_t fileSize = dataMb * 1024 * 1024 / files;
+    std::mt19937_64 random(files);
+    std::vector<uint64_t> chunk(64 * 1024 / sizeof(uint64_t));
+    for (size_t i = 0; i < files; ++i) {
+        std::ofstream out(dir / ("file" + std::to_string(i) + ".bin"),
+                          std::ios::binary);
+        for (size_t written = 0; written < fileSize;) {
+            for (uint64_t &word : chunk)
+                word = random();
+            size_t n = std::min(fileSize - written, chunk.size() * 8);
+            out.write(reinterpret_cast<const char *>(chunk.data()), n);
+            written += n;
+        }
+    }
+}
+
+//------------------------------
+// Workload of a cell
+//------------------------------
+static size_t NextBlockSize(const std::string &sizes, std::mt19937 &random,
+                            size_t maxSize) {
+    if (sizes == "fixed")
+        return maxSize;
+    if (sizes == "small") {
+        // 90% of blocks are up to 64 bytes
+        if (random() % 10 != 0)
+            return 1 + random() % 64;
+    }
+    return 1 + random() % maxSize;
+}
+
+static const size_t BLOCKS_PER_BATCH = 64;
+
+// Opens the input and the output of a copy, nothing stays open on failure
+static bool OpenFiles(const fs::path &input, const fs::path &output, int &in,
+                      int &out) {
+    in = open(input.c_str(), O_RDONLY);
+    out = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (in >= 0 && out >= 0)
+        return true;
+    if (in >= 0)
+        close(in);
+    if (out >= 0)
+        close(out);
+    return false;
+}
+
+// Loads a whole file into blocks, then writes them out in the order of
+// the pattern and frees them
+static bool CopyFile(const fs::path &input, const fs::path &output,
+                     const Cell &cell, size_t seed) {
+    std::mt19937 random(seed);
+    int in = -1;
+    int out = -1;
+    if (!OpenFiles(input, output, in, out))
+        return false;
+
+    const size_t length = fs::file_size(input);
+    std::vector<MemoryBlock> blocks;
+    std::vector<size_t> offsets;
+    bool ok = true;
+    size_t read = 0;
+    while (ok && read < length) {
+        size_t first = blocks.size();
+        size_t batchSize = 0;
+        while (read + batchSize < length &&
+               blocks.size() - first < BLOCKS_PER_BATCH) {
+            size_t size = NextBlockSize(cell.sizes, random,
+                                        memoryManager.maxBlockSize());
+            size = std::min(size, length - read - batchSize);
+            offsets.push_back(read + batchSize);
+            blocks.push_back(memoryManager.getBlock(size));
+            batchSize += size;
+        }
+        size_t done = memoryManager.readInto(in, &blocks.at(first),
+                                             blocks.size() - first);
+        ok = done == batchSize;
+        read += done;
+    }
+
+    // after a short read the blocks are only freed
+    if (ok && cell.pattern == "random") {
+        std::vector<size_t> order(blocks.size());
+        std::iota(begin(order), end(order), 0);
+        std::shuffle(begin(order), end(order), random);
+        for (size_t i : order) {
+            MemoryBlock &block = blocks[i];
+            auto data = block.data<const char>(); // locked while it's alive
+            ok = ok && pwrite(out, data, block.size(), offsets[i]) ==
+                           static_cast<ssize_t>(block.size());
+        }
+    } else if (ok) {
+        for (size_t first = 0; first < blocks.size();
+             first += BLOCKS_PER_BATCH) {
+            size_t count = std::min(BLOCKS_PER_BATCH, blocks.size() - first);
+            size_t batchSize = 0;
+            for (size_t i = first; i < first + count; ++i)
+                batchSize += blocks[i].size();
+            ok = ok && memoryManager.writeFrom(out, &blocks.at(first),
+                                               count) == batchSize;
+        }
+    }
+    for (MemoryBlock &block : blocks)
+        block.free();
+    close(in);
+    close(out);
+    return ok;
+}
+
+// The same copy through a region of raw memory: the file is read into the
+// region at once, then written out by chunks of the same sizes as blocks
+// of the handle cells. Faults of the region are added to `faults`.
+static bool CopyFilePaged(const fs::path &input, const fs::path &output,
+                          const Cell &cell, size_t seed, size_t ramLimit,
+                          std::atomic<uint64_t> &faults) {
+    std::mt19937 random(seed);
+    int in = -1;
+    int out = -1;
+    if (!OpenFiles(input, output, in, out))
+        return false;
+
+    const size_t length = fs::file_size(input);
+    PagedRegion region(length, ramLimit);
+    char *data = region.data();
+    // without kernel faults read() and write() can't touch paged out
+    // memory, so data goes through a buffer
+    std::vector<char> buffer(region.kernelAccess() ? 0 : 64 * 1024);
+    bool ok = true;
+    for (size_t read = 0; ok && read < length;) {
+        size_t chunk = std::min<size_t>(length - read, 1024 * 1024);
+        ssize_t n = 0;
+        if (buffer.empty()) {
+            n = ::read(in, data + read, chunk);
+        } else {
+            n = ::read(in, buffer.data(), std::min(chunk, buffer.size()));
+            if (n > 0)
+                std::memcpy(data + read, buffer.data(), n);
+        }
+        ok = n > 0;
+        read += std::max<ssize_t>(n, 0);
+    }
+
+    auto writeChunk = [&](size_t offset, size_t size) {
+        if (!buffer.empty()) {
+            for (size_t done = 0; done < size;) {
+                size_t n = std::min(size - done, buffer.size());
+                std::memcpy(buffer.data(), data + offset + done, n);
+                if (pwrite(out, buffer.data(), n, offset + done) !=
+                    static_cast<ssize_t>(n))
+                    return false;
+                done += n;
+            }
+            return true;
+        }
+        return pwrite(out, data + offset, size, offset) ==
+               static_cast<ssize_t>(size);
+    };
+    if (cell.pattern == "random") {
+        std::vector<std::pair<size_t, size_t>> chunks;
+        for (size_t offset = 0; offset < length;) {
+            size_t maxSize = memoryManager.maxBlockSize();
+            size_t size = std::min(length - offset,
+                                   NextBlockSize(cell.sizes, random, maxSize));
+            chunks.emplace_back(offset, size);
+            offset += size;
+        }
+        std::shuffle(begin(chunks), end(chunks), random);
+        for (const auto &[offset, size] : chunks)
+            ok = ok && writeChunk(offset, size);
+    } else {
+        for (size_t offset = 0; ok && offset < length;) {
+            size_t size = std::min<size_t>(length - offset, 1024 * 1024);
+            ok = writeChunk(offset, size);
+            offset += size;
+        }
+    }
+    faults += region.counters().faults;
+    close(in);
+    close(out);
+    return ok;
+}
+
+// The same copy through a SwappableVector: the file is appended to it, then
+// written out through the sequential cursor, which reads the next page
+// ahead from swap, or by chunks of the sizes of blocks in random order.
+static bool CopyFileVector(const fs::path &input, const fs::path &output,
+                           const Cell &cell, size_t seed) {
+    std::mt19937 random(seed);
+    int in = -1;
+    int out = -1;
+    if (!OpenFiles(input, output, in, out))
+        return false;
+
+    SwappableVector<char> vector;
+    std::vector<char> buffer(64 * 1024);
+    bool ok = true;
+    for (ssize_t n = 1; ok && n > 0;) {
+        n = ::read(in, buffer.data(), buffer.size());
+        ok = n >= 0;
+        if (n > 0)
+            vector.append(buffer.data(), n);
+    }
+
+    const size_t length = vector.size();
+    auto writeChunk = [&](size_t offset, size_t size) {
+        return pwrite(out, buffer.data(), size, offset) ==
+               static_cast<ssize_t>(size);
+    };
+    if (cell.pattern == "random") {
+        std::vector<std::pair<size_t, size_t>> chunks;
+        for (size_t offset = 0; offset < length;) {
+            size_t maxSize = memoryManager.maxBlockSize();
+            size_t size = std::min(length - offset,
+                                   NextBlockSize(cell.sizes, random, maxSize));
+            chunks.emplace_back(offset, size);
+            offset += size;
+        }
+        std::shuffle(begin(chunks), end(chunks), random);
+        for (const auto &[offset, size] : chunks) {
+            vector.copy(offset, size, buffer.data());
+            ok = ok && writeChunk(offset, size);
+        }
+    } else {
+        size_t offset = 0;
+        size_t filled = 0;
+        for (char &ch : vector.sequential()) {
+            buffer[filled++] = ch;
+            if (filled == buffer.size()) {
+                ok = ok && writeChunk(offset, filled);
+                offset += filled;
+                filled = 0;
+            }
+        }
+        ok = ok && writeChunk(offset, filled);
+    }
+    close(in);
+    close(out);
+    return ok;
+}
+
+static bool SameContent(const fs::path &a, const fs::path &b) {
+    std::ifstream fa(a, std::ios::binary);
+    std::ifstream fb(b, std::ios::binary);
+    std::vector<char> bufA(64 * 1024);
+    std::vector<char> bufB(64 * 1024);
+    while (fa && fb) {
+        fa.read(bufA.data(), bufA.size());
+        fb.read(bufB.data(), bufB.size());
+        if (fa.gcount() != fb.gcount() ||
+            std::memcmp(bufA.data(), bufB.data(), fa.gcount()) != 0)
+            return false;
+    }
+    return fa.eof() && fb.eof();
+}
+
+// Runs in the child process
+static CellResult RunCell(const Cell &cell, const fs::path &inputDir,
+                          const fs::path &workDir) {
+    const fs::path outputDir = workDir / "output";
+    fs::remove_all(outputDir);
+    fs::create_directories(outputDir);
+    SwapConfig config;
+    config.dir = workDir / "swap";
+    fs::create_directories(config.dir);
+    // paged cells give half of the limit to regions of the threads, and
+    // the manager keeps their evicted pages in the other half
+    const size_t ramLimit = cell.ramMb * 1024 * 1024;
+    const bool paged = cell.api == "paged";
+    memoryManager.init(paged ? ramLimit / 2 : ramLimit, config);
+    const size_t regionLimit = ramLimit / 2 / cell.threads;
+
+    std::vector<fs::path> files;
+    for (const auto &entry : fs::directory_iterator(inputDir))
+        files.push_back(entry.path().filename());
+    std::sort(begin(files), end(files));
+
+    // threads take files one by one, with fewer files some of them idle
+    CellResult result{};
+    std::atomic<size_t> nextFile = 0;
+    std::atomic<bool> ok = true;
+    std::atomic<uint64_t> faults = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < cell.threads; ++t) {
+        threads.emplace_back([&]() {
+            for (size_t i = nextFile++; i < files.size(); i = nextFile++) {
+                bool copied = false;
+                if (paged) {
+                    copied = CopyFilePaged(inputDir / files[i],
+                                           outputDir / files[i], cell, i,
+                                           regionLimit, faults);
+                } else if (cell.api == "vector") {
+                    copied = CopyFileVector(inputDir / files[i],
+                                            outputDir / files[i], cell, i);
+                } else {
+                    copied = CopyFile(inputDir / files[i],
+                                      outputDir / files[i], cell, i);
+                }
+                if (!copied)
+                    ok = false;
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+    result.wallMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+
+    for (const fs::path &file : files) {
+        result.bytes += fs::file_size(inputDir / file);
+        if (!SameContent(inputDir / file, outputDir / file))
+            ok = false;
+    }
+    ManagerCounters counters = memoryManager.counters();
+    result.swapIns = counters.swapIns;
+    result.swapOuts = counters.swapOuts;
+    result.pageFaults = faults;
+    result.ok = ok;
+    fs::remove_all(outputDir);
+    return result;
+}
+
+//------------------------------
+// False sharing
+//------------------------------
+struct SharingCell {
+    bool isolate;
+    size_t threads;
+    size_t blockSize;
+};
+
+struct SharingResult {
+    uint64_t wallMs;
+    uint64_t updates;
+    uint64_t ok;
+};
+
+static const size_t SHARING_BLOCKS = 64;      // per thread
+static const size_t SHARING_ROUNDS = 1000000; // updates of every block
+
+// Blocks are allocated round robin, so neighbouring ram blocks belong to
+// different threads. Every thread keeps its blocks locked and increments
+// a counter in each of them.
+static SharingResult RunSharingCell(const SharingCell &cell,
+                                    const fs::path &workDir) {
+    SwapConfig config;
+    config.dir = workDir / "swap";
+    fs::create_directories(config.dir);
+    PoolConfig poolConfig;
+    poolConfig.isolateFrames = cell.isolate;
+    MemoryManager manager(16 * 1024 * 1024, config, poolConfig);
+
+    std::vector<std::vector<MemoryBlock>> blocks(cell.threads);
+    for (size_t i = 0; i < SHARING_BLOCKS; ++i) {
+        for (std::vector<MemoryBlock> &own : blocks) {
+            own.push_back(manager.getBlock(cell.blockSize));
+            own.back().lock();
+            std::memset(own.back().data(), 0, cell.blockSize);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (std::vector<MemoryBlock> &own : blocks) {
+        threads.emplace_back([&own]() {
+            std::vector<volatile uint64_t *> counters;
+            for (MemoryBlock &block : own)
+                counters.push_back(block.data<uint64_t>());
+            for (size_t round = 0; round < SHARING_ROUNDS; ++round) {
+                for (volatile uint64_t *counter : counters)
+                    *counter = *counter + 1;
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+
+    SharingResult result{};
+    result.wallMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    result.updates = cell.threads * SHARING_BLOCKS * SHARING_ROUNDS;
+    result.ok = true;
+    for (std::vector<MemoryBlock> &own : blocks) {
+        for (MemoryBlock &block : own) {
+            if (*block.data<const uint64_t>() != SHARING_ROUNDS)
+                result.ok = false;
+            block.unlock();
+            block.free();
+        }
+    }
+    return result;
+}
+
+// Runs `run` in a forked child, its peak RSS comes from wait4()
+template <typename Result, typename Run>
+static bool RunInChild(Run run, Result &result, long &peakRssKb) {
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0)
+        return false;
+    if (pid == 0) {
+        close(fds[0]);
+        // the manager reports its pools on stdout
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        Result childResult = run();
+        ssize_t n = write(fds[1], &childResult, sizeof(childResult));
+        close(fds[1]);
+        exit(n == sizeof(childResult) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    ssize_t n = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status = 0;
+    rusage usage{};
+    wait4(pid, &status, 0, &usage);
+    peakRssKb = usage.ru_maxrss;
+    return n == sizeof(result) && WIFEXITED(status) &&
+           WEXITSTATUS(status) == 0;
+}
+
+static int RunSharingMatrix(const std::vector<size_t> &threads,
+                            const fs::path &workDir,
+                            const fs::path &csvFile) {
+    std::ofstream csv(csvFile);
+    csv << "isolate,threads,block_size,wall_ms,m_updates_per_s,"
+           "peak_rss_kb,ok\n";
+    size_t failed = 0;
+    for (size_t numThreads : threads) {
+        for (size_t blockSize : {16, 32}) {
+            for (bool isolate : {false, true}) {
+                SharingCell cell{isolate, numThreads, blockSize};
+                SharingResult result{};
+                long peakRssKb = 0;
+                bool done = RunInChild(
+                    [&]() { return RunSharingCell(cell, workDir); }, result,
+                    peakRssKb);
+                bool ok = done && result.ok;
+                failed += ok ? 0 : 1;
+
+                double perS = result.updates / 1000.0 /
+                              std::max<uint64_t>(1, result.wallMs);
+                std::ostringstream line;
+                line << isolate << "," << numThreads << "," << blockSize
+                     << "," << result.wallMs << "," << perS << ","
+                     << peakRssKb << "," << (ok ? 1 : 0);
+                csv << line.str() << std::endl;
+                std::cout << line.str() << std::endl;
+            }
+        }
+    }
+    std::cout << "Results are written to " << csvFile.string() << std::endl;
+    return failed == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    std::map<std::string, std::string> options =
+        utils::ParseOptions(argc, argv, 1);
+    if (options.count("help")) {
+        std::cout << "Usage: " << std::endl;
+        std::cout << "\t" << argv[0] << " [options]" << std::endl;
+        std::cout << "Options (lists are comma separated):" << std::endl;
+        std::cout << "\t--ram=MB,...  RAM limits (default: 1,8)" << std::endl;
+        std::cout << "\t--threads=N,...  (default: 1,4)" << std::endl;
+        std::cout << "\t--sizes=uniform,small,fixed  block size distributions"
+                  << std::endl;
+        std::cout << "\t--files=N,...  file counts (default: 1,4)"
+                  << std::endl;
+        std::cout << "\t--pattern=sequential,random  write out order"
+                  << std::endl;
+        std::cout << "\t--api=handles,paged,vector  MemoryBlock, PagedRegion "
+                     "or SwappableVector"
+                  << std::endl;
+        std::cout << "\t--false-sharing  update counters in neighbouring "
+                     "blocks of --threads instead of copying"
+                  << std::endl;
+        std::cout << "\t--data=MB  bytes of every cell (default: 16)"
+                  << std::endl;
+        std::cout << "\t--dir=PATH  work directory (default: bench_work)"
+                  << std::endl;
+        std::cout << "\t--out=PATH  CSV file (default: bench.csv)"
+                  << std::endl;
+        return 0;
+    }
+    auto option = [&](const std::string &name, const std::string &value) {
+        return options.count(name) ? options[name] : value;
+    };
+    const std::vector<size_t> rams = SplitNumbers(option("ram", "1,8"));
+    const std::vector<size_t> threads = SplitNumbers(option("threads", "1,4"));
+    const std::vector<std::string> sizes =
+        SplitList(option("sizes", "uniform,small,fixed"));
+    const std::vector<size_t> fileCounts = SplitNumbers(option("files", "1,4"));
+    const std::vector<std::string> patterns =
+        SplitList(option("pattern", "sequential,random"));
+    const std::vector<std::string> apis =
+        SplitList(option("api", "handles,paged,vector"));
+    const size_t dataMb = std::stoul(option("data", "16"));
+    const fs::path workDir = option("dir", "bench_work");
+    const fs::path csvFile = option("out", "bench.csv");
+
+    if (options.count("false-sharing"))
+        return RunSharingMatrix(threads, workDir, csvFile);
+
+    for (size_t files : fileCounts)
+        GenerateInput(InputDir(workDir, files, dataMb), files, dataMb);
+
+    std::ofstream csv(csvFile);
+    csv << "ram_mb,threads,sizes,files,pattern,api,data_mb,wall_ms,mb_per_s,"
+           "swap_ins,swap_outs,page_faults,peak_rss_kb,ok\n";
+    std::vector<Cell> cells;
+    for (size_t ram : rams)
+        for (size_t numThreads : threads)
+            for (const std::string &size : sizes)
+                for (size_t files : fileCounts)
+                    for (const std::string &pattern : patterns)
+                        for (const std::string &api : apis)
+                            cells.push_back(
+                                {ram, numThreads, size, files, pattern, api});
+
+    size_t failed = 0;
+    for (const Cell &cell : cells) {
+        CellResult result{};
+        long peakRssKb = 0;
+        const fs::path inputDir = InputDir(workDir, cell.files, dataMb);
+        bool done = RunInChild(
+            [&]() { return RunCell(cell, inputDir, workDir); }, result,
+            peakRssKb);
+        bool ok = done && result.ok;
+        failed += ok ? 0 : 1;
+
+        double mbPerS = result.bytes / 1048576.0 * 1000 /
+                        std::max<uint64_t>(1, result.wallMs);
+        std::ostringstream line;
+        line << cell.ramMb << "," << cell.threads << "," << cell.sizes << ","
+             << cell.files << "," << cell.pattern << "," << cell.api << ","
+             << dataMb << "," << result.wallMs << "," << mbPerS << ","
+             << result.swapIns << "," << result.swapOuts << ","
+             << result.pageFaults << "," << peakRssKb << "," << (ok ? 1 : 0);
+        csv << line.str() << std::endl;
+        std::cout << line.str() << std::endl;
+    }
+    std::cout << "Results are written to " << csvFile.string() << std::endl;
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+//---------------------------------------------------------------
+// memmgr_top - shows live statistics of a running memory manager.
+// It maps the file written by MemoryManager::publishStatistics()
+// read-only and never coordinates with the process.
+//---------------------------------------------------------------
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "memory_manager/stats_page.hpp"
+#include "utils/table.hpp"
+#include "utils/utils.hpp"
+
+using utils::HumanReadable;
+using utils::hr;
+
+static void PrintSnapshot(const std::string &file,
+                          const StatsSnapshot &snapshot) {
+    uint64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count();
+    bool alive = kill(static_cast<pid_t>(snapshot.pid), 0) == 0;
+    std::cout << file << "  pid " << snapshot.pid
+              << (alive ? "" : " (not running)") << ", updated "
+              << (nowMs - snapshot.updateTimeMs) << " ms ago\n\n";
+
+    utils::Table table({12, 14, 14, 9, 12, 12, 12});
+    table << hr << "Block size"
+          << "Blocks (RAM)"
+          << "Used"
+          << "Locked"
+          << "Swapped"
+          << "Swap level"
+          << "Demoted" << hr;
+    size_t ramUsage = 0;
+    size_t swapUsage = 0;
+    for (uint64_t i = 0; i < snapshot.numPools && i < STATS_MAX_POOLS; ++i) {
+        const StatsSnapshot::Pool &pool = snapshot.pools[i];
+        table << pool.blockSize << pool.numBlocks << pool.used << pool.locked
+              << pool.swapped << pool.swapLevels << pool.demoted;
+        ramUsage += pool.blockSize * pool.used;
+        swapUsage += pool.blockSize * pool.swapped;
+    }
+    table << hr;
+    std::cout << table;
+    std::cout << "Memory manager usage [Limit RAM: "
+              << HumanReadable{snapshot.memoryLimit} << ", "
+              << "Used RAM: " << HumanReadable{ramUsage} << ", "
+              << "Disk(swap): " << HumanReadable{swapUsage} << "]\n";
+    for (uint64_t t = 0; t < snapshot.numTiers && t < STATS_MAX_TIERS; ++t) {
+        std::cout << "Swap tier " << t
+                  << " [Used: " << HumanReadable{snapshot.tiers[t].used};
+        if (snapshot.tiers[t].capacity != 0)
+            std::cout << " of " << HumanReadable{snapshot.tiers[t].capacity};
+        std::cout << "]\n";
+    }
+    std::cout << "Working set: " << HumanReadable{snapshot.workingSet}
+              << ", accesses: " << snapshot.accesses
+              << ", swap-ins: " << snapshot.swapIns << "\n";
+    std::cout << "Predicted miss ratio [";
+    for (size_t i = 0; i < STATS_CURVE_POINTS; ++i) {
+        std::cout << (i ? ", " : "") << STATS_CURVE_FACTORS[i]
+                  << "x RAM: " << snapshot.missRatioPpm[i] / 10000 << "."
+                  << snapshot.missRatioPpm[i] / 1000 % 10 << "%";
+    }
+    std::cout << "]\n";
+
+    if (snapshot.numTenants != 0) {
+        utils::Table tenants({8, 12, 12, 12, 12, 12});
+        tenants << hr << "Tenant"
+                << "Reserved"
+                << "Limit"
+                << "RAM"
+                << "Swap-ins"
+                << "Swap-outs" << hr;
+        for (uint64_t i = 0;
+             i < snapshot.numTenants && i < STATS_MAX_TENANTS; ++i) {
+            const StatsSnapshot::Tenant &tenant = snapshot.tenants[i];
+            tenants << tenant.id << HumanReadable{tenant.reserved};
+            if (tenant.limit == 0)
+                tenants << "-";
+            else
+                tenants << HumanReadable{tenant.limit};
+            tenants << HumanReadable{tenant.ramBytes} << tenant.swapIns
+                    << tenant.swapOuts;
+        }
+        tenants << hr;
+        std::cout << tenants;
+    }
+    std::cout << std::flush;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cout << "Usage: " << std::endl;
+        std::cout << "\t" << argv[0] << " [statistics file] [options]"
+                  << std::endl;
+        std::cout << "Options:" << std::endl;
+        std::cout << "\t--interval=MS  refresh period (default: 1000)"
+                  << std::endl;
+        std::cout << "\t--once  print statistics once and exit" << std::endl;
+        return 1;
+    }
+    const std::string file = argv[1];
+    std::map<std::string, std::string> options =
+        utils::ParseOptions(argc, argv, 2);
+    const bool once = options.count("once") != 0;
+    std::chrono::milliseconds interval(1000);
+    if (options.count("interval")) {
+        interval = std::chrono::milliseconds(std::stoi(options["interval"]));
+    }
+
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Can't open statistics file " << file << std::endl;
+        return 1;
+    }
+    void *address = mmap(nullptr, sizeof(StatsPage), PROT_READ, MAP_SHARED,
+                         fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+        std::cerr << "Can't map statistics file " << file << std::endl;
+        return 1;
+    }
+    const StatsPage &page = *static_cast<const StatsPage *>(address);
+
+    while (true) {
+        StatsSnapshot snapshot;
+        StatsPageState state = ReadStatsPage(page, snapshot);
+        if (state == StatsPageState::Invalid) {
+            std::cerr << file << " is not a memory manager statistics file"
+                      << std::endl;
+            return 1;
+        }
+        if (state == StatsPageState::Stale) {
+            // a restarted manager rewrites the page, so watching goes on
+            std::cerr << file << " is stale: its writer has stopped in the "
+                      << "middle of an update" << std::endl;
+            if (once)
+                return 1;
+            std::this_thread::sleep_for(interval);
+            continue;
+        }
+        if (!once)
+            std::cout << "\033[H\033[2J"; // clear the terminal
+        PrintSnapshot(file, snapshot);
+        if (once)
+            break;
+        std::this_thread::sleep_for(interval);
+    }
+    munmap(address, sizeof(StatsPage));
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <stdexcept>
+
+#include "block_streambuf.hpp"
+
+// --------------------------------------------------------
+// class BlockStreamBuf
+// --------------------------------------------------------
+BlockStreamBuf::BlockStreamBuf(MemoryBlock *blocks, size_t count,
+                               std::ios_base::openmode mode)
+    : blocks(blocks), count(count), mode(mode), current(count) {
+    bool in = (mode & std::ios_base::in) != 0;
+    bool out = (mode & std::ios_base::out) != 0;
+    if (in == out) {
+        throw std::invalid_argument(
+            "BlockStreamBuf(): exactly one of in and out modes is expected");
+    }
+
+    offsets.reserve(count + 1);
+    size_t offset = 0;
+    for (size_t i = 0; i < count; ++i) {
+        offsets.push_back(offset);
+        offset += blocks[i].size();
+    }
+    offsets.push_back(offset);
+}
+
+BlockStreamBuf::~BlockStreamBuf() { leave(); }
+
+size_t BlockStreamBuf::position() const {
+    if (current == count)
+        return streamPos;
+    if (mode & std::ios_base::in)
+        return offsets[current] + (gptr() - eback());
+    return offsets[current] + (pptr() - pbase());
+}
+
+// Pins the block which contains stream position `at` (empty blocks are
+// skipped) and sets the get or put area to it
+bool BlockStreamBuf::enter(size_t at) {
+    leave();
+    streamPos = at;
+    if (at >= offsets.back())
+        return false;
+
+    // the last block which starts at or before `at` is not empty
+    size_t index =
+        std::upper_bound(begin(offsets), end(offsets), at) - begin(offsets) - 1;
+    MemoryBlock &block = blocks[index];
+    wasLocked = block.isLocked();
+    current = index;
+
+    // it's locked already, so there is no auto lock in data() here; a block
+    // shared with clones is copied only if it's written
+    size_t offset = at - offsets[index];
+    if (mode & std::ios_base::in) {
+        if (!wasLocked)
+            block.lockReadOnly();
+        const MemoryBlock &source = block;
+        char *base = const_cast<char *>(
+            static_cast<const char *>(source.data<const char>()));
+        setg(base, base + offset, base + block.size());
+    } else {
+        if (!wasLocked)
+            block.lock();
+        char *base = block.data();
+        setp(base, base + block.size());
+        pbump(static_cast<int>(offset));
+    }
+    return true;
+}
+
+void BlockStreamBuf::leave() {
+    if (current == count)
+        return;
+    streamPos = position();
+    if (!wasLocked)
+        blocks[current].unlock();
+    current = count;
+    setg(nullptr, nullptr, nullptr);
+    setp(nullptr, nullptr);
+}
+
+BlockStreamBuf::int_type BlockStreamBuf::underflow() {
+    if (!(mode & std::ios_base::in))
+        return traits_type::eof();
+    if (gptr() < egptr())
+        return traits_type::to_int_type(*gptr());
+    if (!enter(position()))
+        return traits_type::eof();
+    return traits_type::to_int_type(*gptr());
+}
+
+BlockStreamBuf::int_type BlockStreamBuf::overflow(int_type ch) {
+    if (!(mode & std::ios_base::out))
+        return traits_type::eof();
+    if (traits_type::eq_int_type(ch, traits_type::eof()))
+        return traits_type::not_eof(ch);
+    if (pptr() == epptr() && !enter(position()))
+        return traits_type::eof();
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+    return ch;
+}
+
+BlockStreamBuf::pos_type BlockStreamBuf::seekoff(off_type off,
+                                                 std::ios_base::seekdir dir,
+                                                 std::ios_base::openmode which) {
+    if (!(which & mode))
+        return pos_type(off_type(-1));
+
+    off_type base = 0;
+    if (dir == std::ios_base::cur) {
+        base = position();
+        if (off == 0)
+            return pos_type(base); // tellg()/tellp() keep the block pinned
+    } else if (dir == std::ios_base::end) {
+        base = offsets.back();
+    }
+
+    off_type target = base + off;
+    if (target < 0 || target > static_cast<off_type>(offsets.back()))
+        return pos_type(off_type(-1));
+
+    // the block is pinned again lazily on the next read or write
+    leave();
+    streamPos = target;
+    return pos_type(target);
+}
+
+BlockStreamBuf::pos_type BlockStreamBuf::seekpos(pos_type pos,
+                                                 std::ios_base::openmode which) {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
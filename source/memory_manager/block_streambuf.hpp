@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <ios>
+#include <streambuf>
+#include <vector>
+
+#include "memory_block.hpp"
+
+// --------------------------------------------------------
+// class BlockStreamBuf
+//
+// Exposes a sequence of blocks as one stream of their size() bytes, e.g.
+//
+//     BlockStreamBuf buf(blocks.data(), blocks.size(), std::ios::in);
+//     fout << &buf;
+//
+// The current block is pinned for the whole get (or put) area, so data is
+// moved with memcpy and not locked per call. The buffer works in one
+// direction: std::ios::in reads blocks, std::ios::out overwrites them
+// (writing past the last block fails). Seeking is supported in both.
+// Blocks must outlive the buffer and must not be freed or used by other
+// threads while it's open.
+// --------------------------------------------------------
+class BlockStreamBuf : public std::streambuf {
+    MemoryBlock *blocks;
+    size_t count;
+    std::ios_base::openmode mode;
+    std::vector<size_t> offsets; // of each block in the stream, and the end
+
+    size_t current;       // index of the pinned block, count if none
+    size_t streamPos = 0; // position when no block is pinned
+    bool wasLocked = false;
+
+    bool enter(size_t at);
+    void leave();
+    size_t position() const;
+
+  protected:
+    int_type underflow() override;
+    int_type overflow(int_type ch) override;
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                     std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+  public:
+    // Throws std::invalid_argument unless exactly one of in and out is set
+    BlockStreamBuf(MemoryBlock *blocks, size_t count,
+                   std::ios_base::openmode mode);
+
+    BlockStreamBuf(const BlockStreamBuf &) = delete;
+    BlockStreamBuf &operator=(const BlockStreamBuf &) = delete;
+
+    ~BlockStreamBuf() override;
+};
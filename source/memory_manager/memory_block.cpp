@@ -13,25 +13,21 @@
 // --------------------------------------------------------
 // class MemoryBlock
 // --------------------------------------------------------
-MemoryBlock::MemoryBlock()
-    : ptr_(nullptr), id_(0), capacity_(0), size_(0), locked_(false),
-      pool_(nullptr), moved_(false) {}
+MemoryBlock::MemoryBlock() {}
 
-MemoryBlock::MemoryBlock(void *ptr, SwapIdType id, size_t capacity, size_t size,
-                         bool locked, MemoryPool *pool)
-    : ptr_(ptr), id_(id), capacity_(capacity), size_(size), locked_(locked),
-      pool_(pool), moved_(false) {}
-
-void MemoryBlock::swap(MemoryBlock &other) {
-    std::swap(ptr_, other.ptr_);
-    std::swap(id_, other.id_);
-    std::swap(capacity_, other.capacity_);
-    std::swap(size_, other.size_);
-    std::swap(locked_, other.locked_);
-    std::swap(pool_, other.pool_);
-    std::swap(moved_, other.moved_);
+MemoryBlock::MemoryBlock(MemoryPool *pool, size_t frame, SwapIdType id,
+                         size_t size, bool locked, size_t tenant) {
+    assert(size <= pool->blockSize);
+    f_.pool = pool->index;
+    f_.frame = frame;
+    f_.id = id;
+    f_.size = size;
+    f_.locked = locked;
+    f_.tenant = tenant;
 }
 
+void MemoryBlock::swap(MemoryBlock &other) { std::swap(f_, other.f_); }
+
 MemoryBlock::MemoryBlock(MemoryBlock &&other) { swap(other); }
 
 MemoryBlock &MemoryBlock::operator=(MemoryBlock &&other) {
@@ -39,66 +35,184 @@ MemoryBlock &MemoryBlock::operator=(MemoryBlock &&other) {
     return *this;
 }
 
-size_t MemoryBlock::size() const { return size_; }
+size_t MemoryBlock::frameIndex() const { return f_.frame; }
+
+size_t MemoryBlock::poolIndex() const { return f_.pool; }
+
+MemoryPool *MemoryBlock::pool() const { return MemoryPool::byIndex(f_.pool); }
+
+void *MemoryBlock::ptr() const {
+    return pool()->blockAddressByIndex(f_.frame);
+}
+
+size_t MemoryBlock::size() const { return f_.size; }
 
-size_t MemoryBlock::capacity() const { return capacity_; }
+size_t MemoryBlock::capacity() const {
+    return f_.pool != 0 ? pool()->blockSize : 0;
+}
+
+BlockHandle MemoryBlock::handle() const {
+    checkScopeError();
+    BlockHandle handle;
+    handle.blockIndex = f_.frame;
+    handle.blockSize = static_cast<uint32_t>(capacity());
+    handle.size = static_cast<uint32_t>(f_.size);
+    handle.id = f_.id;
+    return handle;
+}
 
 void MemoryBlock::checkScopeError() const {
-    if (moved_) {
-        LOG_BEGIN
-        logger << "ERROR: you can't use MemoryBlock in old scope after it was "
-                  "moved to a new scope!"
-               << std::endl;
-        LOG_END
+    if (f_.moved) {
+        LOG_ERROR("you can't use MemoryBlock in old scope after it was moved "
+                  "to a new scope!");
+        logger.Flush();
         exit(1);
     }
 }
 
+// the ram block must be locked by the caller
+void MemoryBlock::load() {
+    pool()->loadBlocks(
+        {{frameIndex(), static_cast<SwapIdType>(f_.id), f_.tenant}});
+}
+
+// identifies the block for the miss ratio curve
+uint64_t MemoryBlock::accessKey() const {
+    return (uint64_t(f_.pool) << (FRAME_INDEX_BITS + 8)) |
+           (uint64_t(f_.frame) << 8) | f_.id;
+}
+
+// every pinning of a block is an access for the miss ratio curve
+void MemoryBlock::recordAccess() {
+    MemoryPool *pool_ = pool();
+    pool_->stat.accessCounter++;
+    pool_->missRatioCurve.Access(accessKey(), pool_->blockSize);
+}
+
+// Copy on write: the block gets a ram block of its own, the shared data is
+// left to the clones. A block pinned read-only stays pinned, in the new ram
+// block.
+void MemoryBlock::unshare() {
+    MemoryPool *pool_ = pool();
+    MemoryBlock copy;
+    {
+        TenantScope scope(f_.tenant);
+        copy = pool_->getBlock(f_.size);
+    }
+    // the copy is not shared, so this doesn't recurse
+    copy.lock();
+    pool_->readBlock(f_.frame, f_.id, copy.ptr(), f_.size);
+
+    if (pool_->releaseShared(f_.frame, f_.id)) {
+        // the pin of the copy is passed to the block if it's pinned
+        if (f_.locked)
+            pool_->unlockBlock(ptr());
+        else
+            copy.unlock();
+        f_.frame = copy.f_.frame;
+        f_.id = copy.f_.id;
+    } else {
+        // the clones were freed meanwhile, the data is not shared anymore
+        copy.unlock();
+        copy.free();
+    }
+}
+
+// Only a block pinned read-only can be shared while it's pinned
+void MemoryBlock::makeWritable() {
+    if (pool()->isShared(f_.frame, f_.id))
+        unshare();
+}
+
 void MemoryBlock::lock() {
     checkScopeError();
-    if (locked_ == false) {
-        size_t blockIndex = pool_->blockIndexByAddress(ptr_);
-        pool_->lockBlock(ptr_);
-        pool_->swapMutex.lock();
-        pool_->diskSwap->LoadBlockIntoRam(blockIndex, id_);
-        pool_->swapMutex.unlock();
-        locked_ = true;
+    makeWritable();
+    lockReadOnly();
+}
+
+void MemoryBlock::lockReadOnly() {
+    checkScopeError();
+    if (!f_.locked) {
+        pool()->lockBlock(ptr());
+        try {
+            load();
+        } catch (...) {
+            // no room in swap for the block which is in ram now
+            pool()->unlockBlock(ptr());
+            throw;
+        }
+        f_.locked = true;
+        recordAccess();
     } else {
-        LOG_BEGIN
-        logger << "Info: lock() called for a locked block" << std::endl;
-        LOG_END
+        LOG_INFO("lock() called for a locked block {} of pool {}", f_.frame,
+                 f_.pool);
     }
 }
 
+bool MemoryBlock::tryLock() {
+    checkScopeError();
+    if (f_.locked)
+        return true;
+    MemoryPool *pool_ = pool();
+    if (pool_->isShared(f_.frame, f_.id) || !pool_->tryLockBlock(ptr()))
+        return false;
+
+    // only blocks which are in ram already can be locked without waiting
+    pool_->swapMutex.lock();
+    bool inRam = pool_->diskSwap->isBlockInRam(f_.frame, f_.id);
+    pool_->swapMutex.unlock();
+    if (!inRam) {
+        pool_->unlockBlock(ptr());
+        return false;
+    }
+    f_.locked = true;
+    recordAccess();
+    return true;
+}
+
+bool MemoryBlock::prefetch() {
+    checkScopeError();
+    if (f_.locked)
+        return true;
+    if (!pool()->tryLockBlock(ptr()))
+        return false;
+    load();
+    pool()->unlockBlock(ptr());
+    return true;
+}
+
+void MemoryBlock::readAhead() const {
+    checkScopeError();
+    if (!f_.locked)
+        pool()->readAhead(f_.frame, f_.id);
+}
+
 void MemoryBlock::unlock() {
     checkScopeError();
-    if (locked_ == true) {
-        pool_->unlockBlock(ptr_);
-        locked_ = false;
+    if (f_.locked) {
+        pool()->unlockBlock(ptr());
+        f_.locked = false;
     } else {
-        LOG_BEGIN
-        logger << "Info: unlock() called for an unlocked block" << std::endl;
-        LOG_END
+        LOG_INFO("unlock() called for an unlocked block {} of pool {}",
+                 f_.frame, f_.pool);
     }
 }
 
 bool MemoryBlock::isLocked() const {
     checkScopeError();
-    return locked_;
+    return f_.locked;
 }
 
 void MemoryBlock::free() {
     checkScopeError();
-    pool_->freeBlock(ptr_, id_);
+    if (pool()->releaseShared(f_.frame, f_.id))
+        return; // clones still use the data
+    pool()->missRatioCurve.Forget(accessKey());
+    pool()->freeBlock(ptr(), f_.id);
 }
 
 void MemoryBlock::debugPrint() const {
     checkScopeError();
-    LOG_BEGIN
-    logger << "Block Info: " << std::endl;
-    logger << "ptr: " << ptr_
-           << ", blockIndex: " << pool_->blockIndexByAddress(ptr_) << std::endl;
-    logger << "id: " << id_ << ", size: " << size_ << std::endl;
-    logger << std::endl;
-    LOG_END
+    LOG_INFO("block ptr: {}, blockIndex: {}, id: {}, size: {}", ptr(),
+             f_.frame, f_.id, f_.size);
 }
@@ -1,33 +1,77 @@
 #pragma once
 
+#include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <type_traits>
 
 #include "swap.hpp"
+#include "tenants.hpp"
 
 class MemoryPool;
 
+// A block is packed into 64 bits: it refers to its pool by an index in the
+// global pool registry and to its ram frame by an index in the pool, the
+// address and capacity are resolved through the pool.
+constexpr size_t POOL_INDEX_BITS = 10;
+constexpr size_t FRAME_INDEX_BITS = 26;
+constexpr size_t BLOCK_SIZE_BITS = 13;
+
+// Plain data which identifies a block. It's valid until the block is freed
+// and survives a restart if the manager uses a persistent swap, so it can
+// be stored anywhere and turned back into a block by
+// MemoryManager::attach().
+struct BlockHandle {
+    uint64_t blockIndex = 0;
+    uint32_t blockSize = 0;
+    uint32_t size = 0;
+    SwapIdType id = 0;
+};
+
 // --------------------------------------------------------
 // class MemoryBlock
 // --------------------------------------------------------
 class MemoryBlock {
-    void *ptr_;
-    SwapIdType id_;
-    size_t capacity_;
-    size_t size_;
-    bool locked_;
-    MemoryPool *pool_;
-    bool moved_;
+    friend class MemoryManager;
+    friend class PinSet;
+
+    struct Fields {
+        uint64_t pool : POOL_INDEX_BITS; // 0 - no pool (empty block)
+        uint64_t frame : FRAME_INDEX_BITS;
+        uint64_t id : sizeof(SwapIdType) * 8;
+        uint64_t size : BLOCK_SIZE_BITS;
+        uint64_t locked : 1;
+        uint64_t moved : 1;
+        uint64_t tenant : TENANT_BITS;
 
+        Fields()
+            : pool(0), frame(0), id(0), size(0), locked(false), moved(false),
+              tenant(0) {}
+    } f_;
+
+    // Pins the block for the lifetime of the pointer, read-only if T is
+    // const. The address is taken after locking: a block shared with clones
+    // gets its own ram block when it's locked for writing.
     template <typename T> class AutoLocker {
         T *ptr;
         mutable const MemoryBlock *block;
         bool wasLocked;
 
       public:
-        AutoLocker(T *ptr, const MemoryBlock *block)
-            : ptr(ptr), block(block), wasLocked(block->isLocked()) {
-            if (!wasLocked)
-                const_cast<MemoryBlock *>(block)->lock();
+        explicit AutoLocker(const MemoryBlock *block)
+            : ptr(nullptr), block(block), wasLocked(block->isLocked()) {
+            MemoryBlock *target = const_cast<MemoryBlock *>(block);
+            if constexpr (std::is_const_v<T>) {
+                if (!wasLocked)
+                    target->lockReadOnly();
+            } else {
+                // a block pinned read-only can still be shared
+                if (!wasLocked)
+                    target->lock();
+                else
+                    target->makeWritable();
+            }
+            ptr = static_cast<T *>(block->ptr());
         }
         ~AutoLocker() {
             if (!wasLocked)
@@ -37,11 +81,20 @@ class MemoryBlock {
     };
 
     void swap(MemoryBlock &other);
+    void load();
+    void unshare();
+    void makeWritable();
+    uint64_t accessKey() const;
+    void recordAccess();
+    size_t frameIndex() const;
+    size_t poolIndex() const;
+    MemoryPool *pool() const;
+    void *ptr() const;
 
   public:
     MemoryBlock();
-    MemoryBlock(void *ptr, SwapIdType id, size_t capacity, size_t size,
-                bool locked_, MemoryPool *pool);
+    MemoryBlock(MemoryPool *pool, size_t frame, SwapIdType id, size_t size,
+                bool locked, size_t tenant);
 
     MemoryBlock(const MemoryBlock &) = delete;
     MemoryBlock &operator=(const MemoryBlock &) = delete;
@@ -50,23 +103,49 @@ class MemoryBlock {
     MemoryBlock &operator=(MemoryBlock &&);
 
     template <typename T = char> AutoLocker<T> data() {
-        assert(ptr_ != nullptr);
-        return AutoLocker{static_cast<T *>(ptr_), this};
+        assert(f_.pool != 0);
+        return AutoLocker<T>{this};
     }
 
     template <typename T = const char> AutoLocker<T> data() const {
-        assert(ptr_ != nullptr);
-        return AutoLocker{static_cast<T *>(ptr_), this};
+        static_assert(std::is_const_v<T>, "data() const is read-only");
+        assert(f_.pool != 0);
+        return AutoLocker<T>{this};
     }
 
     size_t size() const;
     size_t capacity() const;
+    BlockHandle handle() const;
 
+    // Pins the block for writing. A block shared with clones (see
+    // MemoryManager::clone) is copied into its own ram block first.
     void lock();
+    // Pins the block for reading only, shared data is not copied. If the
+    // pinned block is written later through data() or lock(), it's copied
+    // into its own ram block then and stays pinned there: pointers taken
+    // before point to the shared data, which is not pinned anymore.
+    void lockReadOnly();
+    // Locks the block only if it's in ram and nobody holds its ram block,
+    // so it never waits for other threads or swap I/O. It fails for a block
+    // shared with clones, as copying it could wait.
+    bool tryLock();
+    // Brings the block into ram without pinning it. Returns false at once
+    // if its ram block is held by somebody else.
+    bool prefetch();
+    // Asks the kernel to read a swapped out block from disk in the
+    // background, so a later lock() doesn't wait for the disk. It doesn't
+    // wait for anything itself and does nothing for blocks in ram or a swap
+    // with direct I/O.
+    void readAhead() const;
     void unlock();
+    // Frees the block, data shared with clones lives until the last of
+    // them is freed
     void free();
     bool isLocked() const;
 
     void checkScopeError() const; // can exit(1)
     void debugPrint() const;
 };
+
+static_assert(sizeof(MemoryBlock) == sizeof(uint64_t),
+              "MemoryBlock must be packed into 64 bits");
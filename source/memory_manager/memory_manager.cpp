@@ -1,40 +1,76 @@
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <climits>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <numeric>
 #include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
 #include <vector>
 
+#include <sys/uio.h>
+#include <unistd.h>
+
 #include "../utils/utils.hpp"
 #include "memory_manager.hpp"
+#include "pin_set.hpp"
 
 MemoryManager &memoryManager = MemoryManager::instance();
 
-void MemoryManager::init(size_t memoryLimit) {
+MemoryManager::MemoryManager(size_t memoryLimit, const SwapConfig &config,
+                             const PoolConfig &poolConfig) {
+    init(memoryLimit, config, poolConfig);
+}
+
+void MemoryManager::init(size_t memoryLimit, const SwapConfig &config,
+                         const PoolConfig &poolConfig) {
     std::lock_guard<std::mutex> guard(mutex);
     assert(memorySize == 0 &&
            "MemoryManager initialized already, can't do it twice");
     memorySize = memoryLimit;
+    swapSpace = std::make_unique<SwapSpace>(config);
+    missRatioCurve = std::make_unique<MissRatioCurve>();
+    tenantTable = std::make_unique<TenantTable>();
 
-    const size_t packOfBlocksSize =
-        std::reduce(begin(blockSizes), end(blockSizes));
+    // tables of pools and padding of frames are counted in the limit too
+    size_t packOfBlocksSize =
+        blockSizes.size() * MemoryPool::METADATA_PER_FRAME;
+    for (size_t size : blockSizes)
+        packOfBlocksSize += MemoryPool::FrameSize(size, poolConfig);
     const size_t N = memorySize / packOfBlocksSize;
     std::cout << "Memory size = " << memorySize << " bytes" << std::endl;
     std::cout << "N = " << N << std::endl;
+    std::cout << "Metadata = "
+              << N * blockSizes.size() * MemoryPool::METADATA_PER_FRAME
+              << " bytes" << std::endl;
 
     for (size_t size : blockSizes) {
-        poolMap[size] = std::make_unique<MemoryPool>(N, size);
+        poolMap[size] = std::make_unique<MemoryPool>(
+            N, size, *swapSpace, *missRatioCurve, *tenantTable, poolConfig);
     }
     std::cout << "MAX_SWAP_LEVEL = " << static_cast<size_t>(MAX_SWAP_LEVEL)
               << std::endl;
 }
 
-MemoryBlock MemoryManager::getBlock(size_t size) {
+MemoryBlock MemoryManager::getBlock(size_t size) { return getBlock(size, 1); }
+
+MemoryBlock MemoryManager::getBlock(size_t size, size_t alignment) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 ||
+        alignment > ALIGN_PAGE) {
+        throw std::invalid_argument(
+            "MemoryManager::getBlock(): alignment must be a power of two up "
+            "to " +
+            std::to_string(ALIGN_PAGE));
+    }
     std::lock_guard<std::mutex> guard(mutex);
     assert(memorySize != 0 && "MemoryManager must be initialized before usage");
-    auto it = poolMap.lower_bound(size);
+    auto it = poolMap.lower_bound(std::max(size, alignment));
     if (it == end(poolMap)) {
         std::cerr << "Can't allocate more than " +
                          std::to_string(blockSizes.back()) +
@@ -44,18 +80,312 @@ MemoryBlock MemoryManager::getBlock(size_t size) {
     return it->second->getBlock(size);
 }
 
+MemoryBlock MemoryManager::attach(const BlockHandle &handle) {
+    std::lock_guard<std::mutex> guard(mutex);
+    assert(memorySize != 0 && "MemoryManager must be initialized before usage");
+    auto it = poolMap.find(handle.blockSize);
+    if (it == end(poolMap)) {
+        throw std::invalid_argument("MemoryManager::attach(): no pool for " +
+                                    std::to_string(handle.blockSize) +
+                                    " bytes blocks");
+    }
+    return it->second->attachBlock(handle);
+}
+
+void MemoryManager::resize(MemoryBlock &block, size_t newSize) {
+    block.checkScopeError();
+    if (newSize <= block.capacity()) {
+        block.f_.size = newSize;
+        return;
+    }
+
+    MemoryBlock newBlock;
+    {
+        // the block stays with its tenant, whoever resizes it
+        TenantScope scope(block.f_.tenant);
+        newBlock = getBlock(newSize);
+    }
+    // different size classes never share a frame, so the new block can be
+    // pinned while the caller still holds the old one
+    try {
+        newBlock.lock();
+    } catch (...) {
+        newBlock.free();
+        throw;
+    }
+    block.pool()->readBlock(block.frameIndex(), block.f_.id, newBlock.ptr(),
+                            block.size());
+    // the new block stays pinned only if the old one was
+    if (block.isLocked())
+        block.unlock();
+    else
+        newBlock.unlock();
+
+    block.free();
+    block = std::move(newBlock);
+}
+
+MemoryBlock MemoryManager::clone(const MemoryBlock &block) {
+    block.checkScopeError();
+    MemoryPool *pool = block.pool();
+    if (block.isLocked()) {
+        // It can be written right now, so it's copied at once. The caller
+        // keeps its pin and its pointers, so the data is saved first and
+        // the source is never unpinned.
+        const char *data = static_cast<const char *>(block.ptr());
+        std::vector<char> buffer(data, data + block.size());
+        MemoryBlock copy;
+        {
+            TenantScope scope(block.f_.tenant);
+            copy = getBlock(buffer.size());
+        }
+        try {
+            copy.lock();
+        } catch (...) {
+            copy.free();
+            throw;
+        }
+        std::copy(begin(buffer), end(buffer), static_cast<char *>(copy.ptr()));
+        copy.unlock();
+        return copy;
+    }
+    pool->shareBlock(block.frameIndex(), block.f_.id);
+    return MemoryBlock{pool, block.frameIndex(),
+                       static_cast<SwapIdType>(block.f_.id), block.size(),
+                       false, block.f_.tenant};
+}
+
+//------------------------------
+// Scatter/gather file I/O
+//------------------------------
+#ifdef IOV_MAX
+static const size_t MAX_IOV = IOV_MAX;
+#else
+static const size_t MAX_IOV = 1024;
+#endif
+
+// Moves data until all vectors are done or end of file is reached
+static size_t TransferVectors(int fd, iovec *iov, size_t iovCount,
+                              bool toFile) {
+    size_t total = 0;
+    while (iovCount > 0) {
+        int n = static_cast<int>(std::min(iovCount, MAX_IOV));
+        ssize_t done = toFile ? writev(fd, iov, n) : readv(fd, iov, n);
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(),
+                                    toFile ? "writev()" : "readv()");
+        }
+        if (done == 0)
+            break; // end of file
+        total += done;
+
+        // skip completed vectors and adjust partially completed one
+        size_t rest = done;
+        while (iovCount > 0 && rest >= iov->iov_len) {
+            rest -= iov->iov_len;
+            ++iov;
+            --iovCount;
+        }
+        if (iovCount > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + rest;
+            iov->iov_len -= rest;
+        }
+    }
+    return total;
+}
+
+size_t MemoryManager::transfer(int fd, MemoryBlock *blocks, size_t count,
+                               bool toFile) {
+    using FrameKey = std::pair<const MemoryPool *, size_t>;
+
+    size_t total = 0;
+    size_t first = 0;
+    std::vector<std::pair<FrameKey, MemoryBlock *>> batch;
+    std::vector<iovec> iov;
+    while (first < count) {
+        // Collect a batch of blocks which can be pinned at the same time:
+        // two blocks sharing one ram frame can't be in ram together.
+        batch.clear();
+        iov.clear();
+        size_t last = first;
+        for (; last < count && last - first < MAX_IOV; ++last) {
+            MemoryBlock &block = blocks[last];
+            block.checkScopeError();
+            // before its address is taken: data shared with clones is
+            // copied, so the block moves
+            if (!toFile && !block.isLocked() &&
+                block.pool()->isShared(block.frameIndex(), block.f_.id))
+                block.unshare();
+            FrameKey key{block.pool(), block.frameIndex()};
+            bool conflict = std::any_of(
+                begin(batch), end(batch),
+                [&key](const auto &pinned) { return pinned.first == key; });
+            if (conflict)
+                break;
+            batch.emplace_back(key, &block);
+            iov.push_back(iovec{block.ptr(), block.size()});
+        }
+
+        // frames are locked in one global order, so threads pinning
+        // batches can't deadlock each other
+        std::vector<MemoryBlock *> pinned;
+        for (auto &[key, block] : batch)
+            pinned.push_back(block);
+        PinSet pins(pinned.data(), pinned.size(), PinSet::Policy::FailFast,
+                    toFile ? PinSet::Access::Read : PinSet::Access::Write);
+
+        size_t expected = 0;
+        for (const iovec &v : iov)
+            expected += v.iov_len;
+
+        size_t done = TransferVectors(fd, iov.data(), iov.size(), toFile);
+        pins.release();
+
+        total += done;
+        if (done < expected)
+            break; // end of file
+        first = last;
+    }
+    return total;
+}
+
+size_t MemoryManager::readInto(int fd, MemoryBlock *blocks, size_t count) {
+    return transfer(fd, blocks, count, false);
+}
+
+size_t MemoryManager::writeFrom(int fd, const MemoryBlock *blocks,
+                                size_t count) {
+    return transfer(fd, const_cast<MemoryBlock *>(blocks), count, true);
+}
+
+void MemoryManager::setTenantQuota(size_t tenant, size_t reserved,
+                                   size_t limit) {
+    std::lock_guard<std::mutex> guard(mutex);
+    assert(memorySize != 0 && "MemoryManager must be initialized before usage");
+    if (tenant >= MAX_TENANTS) {
+        throw std::invalid_argument(
+            "MemoryManager::setTenantQuota(): tenant must be less than " +
+            std::to_string(MAX_TENANTS));
+    }
+    size_t totalReserved = reserved;
+    for (size_t other = 0; other < MAX_TENANTS; ++other) {
+        if (other != tenant)
+            totalReserved += tenantTable->Stat(other).reserved;
+    }
+    if (totalReserved > memorySize) {
+        throw std::invalid_argument("MemoryManager::setTenantQuota(): "
+                                    "reservations exceed the memory limit");
+    }
+    tenantTable->SetQuota(tenant, reserved, limit);
+}
+
 size_t MemoryManager::maxBlockSize() const {
     std::lock_guard<std::mutex> guard(mutex);
     assert(memorySize != 0 && "MemoryManager must be initialized before usage");
     return blockSizes.back();
 }
 
+//------------------------------
+// Statistics for memmgr_top
+//------------------------------
+// pools and swap space don't change after init(), so no locks here
+// tenants without a quota and traffic are not shown
+static bool IsTenantActive(const TenantStat &stat) {
+    return stat.ramBytes != 0 || stat.swapIns != 0 || stat.swapOuts != 0 ||
+           stat.reserved != 0 || stat.limit != SIZE_MAX;
+}
+
+void MemoryManager::collectStatistics(StatsSnapshot &snapshot) const {
+    snapshot.pid = getpid();
+    snapshot.memoryLimit = memorySize;
+    for (const auto &[size, pool] : poolMap) {
+        if (snapshot.numPools == STATS_MAX_POOLS)
+            break;
+        const PoolStat &stat = pool->getStatistics();
+        StatsSnapshot::Pool &record = snapshot.pools[snapshot.numPools++];
+        record.blockSize = size;
+        record.numBlocks = pool->getNumBlocks();
+        record.used = stat.usedCounter;
+        record.locked = stat.lockedCounter;
+        record.swapped = stat.swappedCounter;
+        record.swapLevels = stat.swapLevels;
+        record.demoted = stat.demotedCounter;
+        snapshot.accesses += stat.accessCounter;
+        snapshot.swapIns += stat.swapInCounter;
+    }
+    for (size_t tier = 0;
+         tier < swapSpace->NumTiers() && tier < STATS_MAX_TIERS; ++tier) {
+        snapshot.tiers[tier].used = swapSpace->Used(tier);
+        snapshot.tiers[tier].capacity = swapSpace->Tier(tier).capacity;
+        snapshot.numTiers++;
+    }
+    // the curve is shared with sampled lock() calls: when one of them holds
+    // it, the values of the previous publish are repeated
+    size_t ramBytes[STATS_CURVE_POINTS];
+    double ratios[STATS_CURVE_POINTS];
+    size_t workingSet = 0;
+    for (size_t i = 0; i < STATS_CURVE_POINTS; ++i)
+        ramBytes[i] = static_cast<size_t>(memorySize * STATS_CURVE_FACTORS[i]);
+    if (missRatioCurve->TryRead(ramBytes, STATS_CURVE_POINTS, ratios,
+                                workingSet)) {
+        lastWorkingSet = workingSet;
+        for (size_t i = 0; i < STATS_CURVE_POINTS; ++i)
+            lastMissRatioPpm[i] = static_cast<uint64_t>(ratios[i] * 1e6);
+    }
+    snapshot.workingSet = lastWorkingSet;
+    for (size_t i = 0; i < STATS_CURVE_POINTS; ++i)
+        snapshot.missRatioPpm[i] = lastMissRatioPpm[i];
+    for (size_t tenant = 0; tenant < MAX_TENANTS; ++tenant) {
+        const TenantStat &stat = tenantTable->Stat(tenant);
+        if (!IsTenantActive(stat) || snapshot.numTenants == STATS_MAX_TENANTS)
+            continue;
+        StatsSnapshot::Tenant &record = snapshot.tenants[snapshot.numTenants++];
+        record.id = tenant;
+        record.ramBytes = stat.ramBytes;
+        record.reserved = stat.reserved;
+        record.limit = stat.limit == SIZE_MAX ? 0 : stat.limit.load();
+        record.swapIns = stat.swapIns;
+        record.swapOuts = stat.swapOuts;
+    }
+}
+
+void MemoryManager::publishStatistics(const std::filesystem::path &file,
+                                      std::chrono::milliseconds period) {
+    std::lock_guard<std::mutex> guard(mutex);
+    assert(memorySize != 0 && "MemoryManager must be initialized before usage");
+    statsPublisher.reset();
+    statsPublisher = std::make_unique<StatsPublisher>(
+        file, period,
+        [this](StatsSnapshot &snapshot) { collectStatistics(snapshot); });
+}
+
+ManagerCounters MemoryManager::counters() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    ManagerCounters counters;
+    for (const auto &[size, pool] : poolMap) {
+        const PoolStat &stat = pool->getStatistics();
+        counters.accesses += stat.accessCounter;
+        counters.swapIns += stat.swapInCounter;
+        counters.swapOuts += stat.swapOutCounter;
+        counters.demoted += stat.demotedCounter;
+    }
+    return counters;
+}
+
 //------------------------------
 // Show statistics like a table
 //------------------------------
 using utils::hr;
 using utils::Table;
 
+static std::string Percent(double ratio) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << 100 * ratio << "%";
+    return out.str();
+}
+
 void MemoryManager::printStatistics() const {
     Table table({12, 14, 14, 9, 12, 12});
     table << hr;
@@ -79,6 +409,7 @@ void MemoryManager::printStatistics() const {
         swapUsage += size * stat.swappedCounter;
     }
     mutex.unlock();
+    const ManagerCounters totals = counters();
 
     table << hr;
     std::cout << table;
@@ -86,4 +417,67 @@ void MemoryManager::printStatistics() const {
               << utils::HumanReadable{memorySize} << ", "
               << "Used RAM: " << utils::HumanReadable{ramUsage} << ", "
               << "Disk(swap): " << utils::HumanReadable{swapUsage} << "]\n";
+
+    if (swapSpace->NumTiers() > 1) {
+        for (size_t tier = 0; tier < swapSpace->NumTiers(); ++tier) {
+            const SwapTier &swapTier = swapSpace->Tier(tier);
+            std::cout << "Swap tier " << tier << " ["
+                      << swapTier.dirs.size() << " dir(s), Used: "
+                      << utils::HumanReadable{swapSpace->Used(tier)};
+            if (swapTier.capacity != 0) {
+                std::cout << " of "
+                          << utils::HumanReadable{swapTier.capacity};
+            }
+            std::cout << "]\n";
+        }
+        std::cout << "Blocks demoted to slower tiers: " << totals.demoted
+                  << "\n";
+    }
+
+    // how much RAM would help: the curve predicts share of lock() calls
+    // which need a swap-in for other memory limits
+    std::cout << "Working set: "
+              << utils::HumanReadable{missRatioCurve->WorkingSetBytes()}
+              << ", accesses: " << totals.accesses
+              << ", swap-ins: " << totals.swapIns
+              << ", swap-outs: " << totals.swapOuts;
+    if (totals.accesses != 0) {
+        std::cout << " (miss ratio "
+                  << Percent(double(totals.swapIns) / totals.accesses) << ")";
+    }
+    std::cout << "\nPredicted miss ratio [";
+    for (size_t i = 0; i < STATS_CURVE_POINTS; ++i) {
+        size_t ram = static_cast<size_t>(memorySize * STATS_CURVE_FACTORS[i]);
+        std::cout << (i ? ", " : "") << STATS_CURVE_FACTORS[i]
+                  << "x RAM: " << Percent(missRatioCurve->MissRatio(ram));
+    }
+    std::cout << "]\n";
+
+    // per-tenant usage, if there are tenants besides the default one
+    Table tenants({8, 12, 12, 12, 12, 12});
+    tenants << hr << "Tenant"
+            << "Reserved"
+            << "Limit"
+            << "RAM"
+            << "Swap-ins"
+            << "Swap-outs" << hr;
+    bool showTenants = tenantTable->HasQuotas();
+    for (size_t tenant = 0; tenant < MAX_TENANTS; ++tenant) {
+        const TenantStat &stat = tenantTable->Stat(tenant);
+        if (!IsTenantActive(stat))
+            continue;
+        showTenants = showTenants || tenant != 0;
+        std::ostringstream limit;
+        if (stat.limit == SIZE_MAX)
+            limit << "-";
+        else
+            limit << utils::HumanReadable{stat.limit};
+        tenants << tenant << utils::HumanReadable{stat.reserved} << limit.str()
+                << utils::HumanReadable{stat.ramBytes} << stat.swapIns
+                << stat.swapOuts;
+    }
+    if (showTenants) {
+        tenants << hr;
+        std::cout << tenants;
+    }
 }
@@ -1,26 +1,66 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <vector>
 
 #include "memory_pool.hpp"
+#include "stats_page.hpp"
+
+//-------------------------------------------------------------------
+// Memory manager with its own RAM budget, pools and swap.
+// There is a process-wide instance (memoryManager) which is set up with
+// init(), and independent arenas can be constructed directly, so
+// subsystems don't compete for the same pools and locks. Blocks must be
+// used and freed only while their manager is alive.
+//-------------------------------------------------------------------
+// Totals of all pools of a manager
+struct ManagerCounters {
+    size_t accesses = 0; // lock() calls
+    size_t swapIns = 0;
+    size_t swapOuts = 0;
+    size_t demoted = 0; // to slower swap tiers
+};
+
+// Alignment classes of getBlock(size, alignment), any power of two up to
+// ALIGN_PAGE can be used too
+constexpr size_t ALIGN_CACHE_LINE = CACHE_LINE_SIZE; // SIMD loads and stores
+constexpr size_t ALIGN_PAGE = SWAP_IO_ALIGNMENT;     // O_DIRECT buffers
 
-//-------------------------------------
-// Singleton (uses single swap folder)
-//-------------------------------------
 class MemoryManager {
     size_t memorySize = 0;
     const std::vector<size_t> blockSizes{16,  32,   64,   128, 256,
                                          512, 1024, 2048, 4096};
+    // declared before pools: they return their swap usage on destruction
+    std::unique_ptr<SwapSpace> swapSpace;
+    std::unique_ptr<MissRatioCurve> missRatioCurve;
+    std::unique_ptr<TenantTable> tenantTable;
     std::map<size_t, std::unique_ptr<MemoryPool>> poolMap;
     mutable std::mutex mutex;
+    // declared after pools: it reads their counters until it's stopped
+    std::unique_ptr<StatsPublisher> statsPublisher;
+    // the last miss ratio curve read by the publisher thread
+    mutable uint64_t lastWorkingSet = 0;
+    mutable uint64_t lastMissRatioPpm[STATS_CURVE_POINTS] = {};
 
     MemoryManager() = default;
 
+    size_t transfer(int fd, MemoryBlock *blocks, size_t count, bool toFile);
+    void collectStatistics(StatsSnapshot &snapshot) const;
+
   public:
-    void init(size_t memoryLimit);
+    // A manager takes nine pools of the 1023 which a process can have,
+    // the constructor throws std::bad_alloc when they are used up
+    explicit MemoryManager(size_t memoryLimit,
+                           const SwapConfig &config = SwapConfig{},
+                           const PoolConfig &poolConfig = PoolConfig{});
+
+    void init(size_t memoryLimit, const SwapConfig &config = SwapConfig{},
+              const PoolConfig &poolConfig = PoolConfig{});
 
     static MemoryManager &instance() {
         static MemoryManager memory;
@@ -33,8 +73,57 @@ class MemoryManager {
     MemoryManager &operator=(MemoryManager &&) = delete;
 
     MemoryBlock getBlock(size_t size);
+    // A block whose address is a multiple of `alignment` (a power of two
+    // up to ALIGN_PAGE) whenever it's in ram. Blocks of a class are aligned
+    // to the class size, so it's taken from a class of at least
+    // `alignment` bytes. resize() keeps the alignment only within
+    // capacity(). Throws std::invalid_argument for other alignments.
+    MemoryBlock getBlock(size_t size, size_t alignment);
+    // Reattach to a block by its handle, e.g. after restart with a
+    // persistent swap. Throws std::invalid_argument for unknown blocks.
+    MemoryBlock attach(const BlockHandle &handle);
+    // Changes size of a block keeping its data (up to the new size). It
+    // stays in place within capacity(), otherwise the data is moved to a
+    // block of the right size class, directly from swap if the block is
+    // swapped out. A locked block stays locked. Throws std::bad_alloc if
+    // the new size is too big.
+    void resize(MemoryBlock &block, size_t newSize);
+    // A new block with the same data. It shares the ram block or swap slot
+    // of the original one, and the data is copied only when one of them is
+    // locked for writing (lock(), data() of a non-const type, readInto()),
+    // so a swapped out block is cloned without swap I/O. A block which is
+    // locked at the moment is copied at once. Sharing is not saved in a
+    // persistent swap, a shared block must not be attached twice.
+    MemoryBlock clone(const MemoryBlock &block);
+
+    // Scatter/gather I/O: pin a batch of blocks, bring them into RAM and move
+    // data with a single readv/writev call per batch. readInto() fills
+    // block.size() bytes of each block and returns the number of bytes read
+    // (less than requested only at the end of file). Throws
+    // std::system_error on I/O errors.
+    size_t readInto(int fd, MemoryBlock *blocks, size_t count);
+    size_t writeFrom(int fd, const MemoryBlock *blocks, size_t count);
+
+    // Sets the RAM quota of a tenant (see TenantScope). While the tenant
+    // uses no more than `reserved` bytes, its blocks are evicted only if
+    // blocks of other tenants can't be; above `limit` its own blocks are
+    // evicted first. Blocks which share a ram block still replace each
+    // other on lock(). Throws std::invalid_argument for an unknown tenant,
+    // reserved > limit or reservations above the memory limit.
+    void setTenantQuota(size_t tenant, size_t reserved,
+                        size_t limit = SIZE_MAX);
+
     size_t maxBlockSize() const;
+    ManagerCounters counters() const;
     void printStatistics() const;
+    // Publishes statistics into a memory-mapped file every `period`, to be
+    // watched with memmgr_top. Counters are read without taking any locks
+    // of the manager, the miss ratio curve only with try_lock: if it's
+    // busy, its previous values are published again. Throws
+    // std::system_error if the file can't be mapped.
+    void publishStatistics(const std::filesystem::path &file,
+                           std::chrono::milliseconds period =
+                               std::chrono::milliseconds(500));
 };
 
 // An instance created in memory_manager.cpp
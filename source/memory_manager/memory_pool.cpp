@@ -1,55 +1,135 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <climits>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <filesystem>
 #include <iostream>
 #include <mutex>
+#include <new>
+#include <stdexcept>
 #include <thread>
 
 #include "../utils/logger.hpp"
 #include "memory_pool.hpp"
 
+// --------------------------------------------------------
+// Registry of pools, blocks refer to their pool by an index in it
+// (0 is reserved for empty blocks)
+// --------------------------------------------------------
+static const size_t MAX_POOLS = size_t(1) << POOL_INDEX_BITS;
+static std::array<std::atomic<MemoryPool *>, MAX_POOLS> poolRegistry;
+static std::mutex poolRegistryMutex;
+
+// 0 if the registry is full
+static size_t RegisterPool(MemoryPool *pool) {
+    std::lock_guard<std::mutex> guard(poolRegistryMutex);
+    for (size_t index = 1; index < MAX_POOLS; ++index) {
+        if (poolRegistry[index] == nullptr) {
+            poolRegistry[index] = pool;
+            return index;
+        }
+    }
+    return 0;
+}
+
+static void UnregisterPool(size_t index) {
+    std::lock_guard<std::mutex> guard(poolRegistryMutex);
+    poolRegistry[index] = nullptr;
+}
+
+MemoryPool *MemoryPool::byIndex(size_t index) {
+    assert(index != 0 && index < MAX_POOLS);
+    return poolRegistry[index];
+}
+
 // --------------------------------------------------------
 // class MemoryPool
 // --------------------------------------------------------
-MemoryPool::MemoryPool(size_t numBlocks, size_t blockSize)
+size_t MemoryPool::FrameSize(size_t blockSize, const PoolConfig &config) {
+    return config.isolateFrames ? std::max(blockSize, CACHE_LINE_SIZE)
+                                : blockSize;
+}
+
+MemoryPool::MemoryPool(size_t numBlocks, size_t blockSize, SwapSpace &space,
+                       MissRatioCurve &curve, TenantTable &tenants,
+                       const PoolConfig &config)
     : numBlocks(numBlocks), blockSize(blockSize),
-      totalSize(numBlocks * blockSize) {
+      frameSize(FrameSize(blockSize, config)),
+      totalSize(numBlocks * frameSize), blockIsLocked(numBlocks),
+      queueEntries(numBlocks), frameTenant(numBlocks), missRatioCurve(curve),
+      tenants(tenants) {
     assert(numBlocks > 0);
+    if (numBlocks > (size_t(1) << FRAME_INDEX_BITS) ||
+        blockSize >= (size_t(1) << BLOCK_SIZE_BITS)) {
+        std::cerr << "MemoryPool() can't address " << numBlocks
+                  << " blocks x " << blockSize << " bytes!" << std::endl;
+        exit(1);
+    }
     assert(
         blockSize >=
         sizeof(
             char *)); // empty block contains a pointer to the next empty block
 
-    memoryPtr = static_cast<char *>(malloc(totalSize));
+    // Aligned, so blocks of a sector size go to swap with direct I/O as is.
+    // Block sizes are powers of two, so every block is aligned to its size
+    // too (MemoryManager::getBlock(size, alignment) relies on it).
+    size_t allocSize = (totalSize + SWAP_IO_ALIGNMENT - 1) /
+                       SWAP_IO_ALIGNMENT * SWAP_IO_ALIGNMENT;
+    memoryPtr =
+        static_cast<char *>(std::aligned_alloc(SWAP_IO_ALIGNMENT, allocSize));
     if (!memoryPtr) {
         std::cerr << "MemoryPool() can't allocate " << totalSize
                   << " bytes of memory!" << std::endl;
         exit(1);
     }
 
-    // create internal list of blocks
-    for (size_t i = 0; i < numBlocks - 1; ++i) {
-        char *p = memoryPtr + i * blockSize;
-        *reinterpret_cast<char **>(p) = static_cast<char *>(p + blockSize);
-    }
-    *reinterpret_cast<char **>(memoryPtr + (numBlocks - 1) * blockSize) =
-        nullptr;
-
-    nextBlock = memoryPtr;
-
-    // locker for each block
-    blockIsLocked.resize(numBlocks, 0);
+    // create disk swap (it can restore swapped blocks from a persistent swap)
+    diskSwap = new DiskSwap(this, memoryPtr, numBlocks, blockSize, frameSize,
+                            space);
 
-    // create disk swap
-    diskSwap = new DiskSwap(this, memoryPtr, numBlocks, blockSize);
+    // Ram blocks are not touched here: they are handed out by a bump pointer
+    // and go to the list of free blocks only when they are freed, so pages
+    // of the pool (and of its tables) are mapped in as they are used.
+    // Blocks with restored swapped blocks are occupied and will be loaded
+    // lazily on the first lock().
+    nextBlock = nullptr;
+    numTouched = 0;
+    if (diskSwap->HasDiskLevels()) {
+        numTouched = numBlocks;
+        for (size_t i = numBlocks; i-- > 0;) {
+            frameTenant[i] = NO_TENANT;
+            if (diskSwap->HasSwappedBlocks(i)) {
+                stat.usedCounter++;
+                stat.swappedCounter += diskSwap->CountSwappedBlocks(i);
+            } else {
+                privateFree(memoryPtr + i * frameSize);
+            }
+        }
+        for (size_t i = 0; i < numBlocks; ++i) {
+            if (diskSwap->HasSwappedBlocks(i))
+                enqueueFrame(i);
+        }
+    }
+    index = RegisterPool(this);
+    if (index == 0) {
+        delete diskSwap;
+        std::free(memoryPtr);
+        std::cerr << "MemoryPool() can't create more than " << MAX_POOLS - 1
+                  << " pools!" << std::endl;
+        throw std::bad_alloc();
+    }
 
     std::cout << "Created memory pool " << numBlocks << " blocks x "
               << blockSize << " bytes" << std::endl;
 }
 
 MemoryPool::~MemoryPool() {
+    UnregisterPool(index);
     delete diskSwap;
     std::free(memoryPtr);
 }
@@ -57,15 +137,18 @@ MemoryPool::~MemoryPool() {
 MemoryBlock MemoryPool::getBlock(size_t size) {
     std::lock_guard<std::mutex> poolGuard(poolMutex);
 
+    const size_t tenant = CurrentTenant();
     SwapIdType blockId = 1;
     void *ptr = privateAlloc();
 
     size_t blockIndex = 0;
     if (ptr) {
         blockIndex = blockIndexByAddress(ptr);
-        swapMutex.lock();
-        diskSwap->MarkBlockAllocated(blockIndex, blockId);
-        swapMutex.unlock();
+        {
+            std::lock_guard<std::mutex> swapGuard(swapMutex);
+            diskSwap->MarkBlockAllocated(blockIndex, blockId);
+        }
+        chargeFrame(blockIndex, tenant);
         stat.usedCounter++;
     } else {
         // No free blocks in pool, try to use swap
@@ -73,27 +156,128 @@ MemoryBlock MemoryPool::getBlock(size_t size) {
         // Random block for test :)
         // blockIndex = rand() % numBlocks;
 
-        // The oldest allocated block for task
-        if (!swapQueue.empty()) {
-            blockIndex = swapQueue.front();
-            swapQueue.pop();
-        }
-
+        blockIndex = pickVictim(tenant);
         ptr = blockAddressByIndex(blockIndex);
 
         lockBlock(ptr);
-        swapMutex.lock();
+        bool evicted = false;
+        try {
+            std::lock_guard<std::mutex> swapGuard(swapMutex);
+
+            // ram block can be empty after reattaching to a persistent swap
+            evicted = !diskSwap->isRamSlotEmpty(blockIndex);
 
-        // returns unique id for each new block
-        blockId = diskSwap->Swap(blockIndex);
+            // returns unique id for each new block
+            blockId = diskSwap->Swap(blockIndex);
 
-        diskSwap->MarkBlockAllocated(blockIndex, blockId);
-        swapMutex.unlock();
+            diskSwap->MarkBlockAllocated(blockIndex, blockId);
+        } catch (...) {
+            // all swap tiers are full: the victim stays in ram
+            unlockBlock(ptr);
+            swapQueue.push_front(static_cast<uint32_t>(blockIndex));
+            queueEntries[blockIndex]++;
+            throw;
+        }
+        if (evicted) {
+            stat.swapOutCounter++;
+            tenants.CountSwapOut(frameTenant[blockIndex]);
+        }
+        chargeFrame(blockIndex, tenant);
         unlockBlock(ptr);
-        stat.swappedCounter++;
+        if (evicted)
+            stat.swappedCounter++;
+    }
+    enqueueFrame(blockIndex);
+    return MemoryBlock{this, blockIndex, blockId, size, false, tenant};
+}
+
+MemoryBlock MemoryPool::attachBlock(const BlockHandle &handle) {
+    std::lock_guard<std::mutex> poolGuard(poolMutex);
+    bool known = false;
+    if (handle.blockIndex < numBlocks && handle.id != 0 &&
+        handle.size <= blockSize) {
+        std::lock_guard<std::mutex> swapGuard(swapMutex);
+        known = diskSwap->isBlockKnown(handle.blockIndex, handle.id);
+    }
+    if (!known) {
+        throw std::invalid_argument(
+            "MemoryPool::attachBlock(): no such block in the pool");
+    }
+    return MemoryBlock{this, handle.blockIndex, handle.id,
+                       handle.size, false, CurrentTenant()};
+}
+
+// The oldest allocated ram block, with quotas the oldest one among the
+// first EVICTION_SCAN ones whose tenant can give it up most easily. If all
+// of them are within reservations, the scan goes on until a block which
+// is not is found.
+// Locked ram blocks are skipped: the caller itself can hold some of them
+// (see PinSet), then waiting for one would never end.
+static const size_t EVICTION_SCAN = 64;
+
+size_t MemoryPool::pickVictim(size_t requester) {
+    // the front is always the last entry of its ram block
+    while (!swapQueue.empty() && queueEntries[swapQueue.front()] > 1) {
+        queueEntries[swapQueue.front()]--;
+        swapQueue.pop_front();
+    }
+    if (swapQueue.empty())
+        return 0;
+    std::lock_guard<std::mutex> lockGuard(blockMutex);
+    auto victim = end(swapQueue);
+    int victimRank = INT_MAX;
+    size_t scanned = 0;
+    for (auto it = begin(swapQueue);
+         it != end(swapQueue) && victimRank > 0 &&
+         (scanned < EVICTION_SCAN || victimRank >= TenantTable::RESERVED_RANK);
+         ++it) {
+        // older entries of reallocated ram blocks are skipped (the last one
+        // is skipped too until they are gone)
+        if (blockIsLocked[*it] || queueEntries[*it] > 1)
+            continue;
+        ++scanned;
+        int rank = tenants.HasQuotas()
+                       ? tenants.EvictionRank(frameTenant[*it], requester)
+                       : 0;
+        if (rank < victimRank) {
+            victim = it;
+            victimRank = rank;
+        }
+    }
+    // everything is locked, wait for the oldest one
+    if (victim == end(swapQueue))
+        victim = begin(swapQueue);
+    size_t blockIndex = *victim;
+    swapQueue.erase(victim);
+    queueEntries[blockIndex]--;
+    return blockIndex;
+}
+
+void MemoryPool::enqueueFrame(size_t blockIndex) {
+    if (swapQueue.size() >= 2 * numBlocks ||
+        queueEntries[blockIndex] == UINT8_MAX) {
+        compactSwapQueue();
     }
-    swapQueue.push(blockIndex);
-    return MemoryBlock{ptr, blockId, blockSize, size, false, this};
+    swapQueue.push_back(static_cast<uint32_t>(blockIndex));
+    queueEntries[blockIndex]++;
+}
+
+// Keeps only the last entry of every ram block, in the same order
+void MemoryPool::compactSwapQueue() {
+    std::deque<uint32_t> compacted;
+    for (uint32_t blockIndex : swapQueue) {
+        if (queueEntries[blockIndex] > 1)
+            queueEntries[blockIndex]--;
+        else
+            compacted.push_back(blockIndex);
+    }
+    swapQueue.swap(compacted);
+}
+
+// the ram block must be locked by the caller (or just allocated)
+void MemoryPool::chargeFrame(size_t blockIndex, size_t tenant) {
+    size_t previous = frameTenant[blockIndex].exchange(tenant);
+    tenants.Charge(previous, tenant, frameSize);
 }
 
 void *MemoryPool::privateAlloc() {
@@ -102,6 +286,10 @@ void *MemoryPool::privateAlloc() {
         nextBlock = *reinterpret_cast<char **>(nextBlock);
         return block;
     }
+    if (numTouched < numBlocks) {
+        frameTenant[numTouched] = NO_TENANT;
+        return memoryPtr + numTouched++ * frameSize;
+    }
 
     // No free blocks
     return nullptr;
@@ -115,11 +303,11 @@ void MemoryPool::privateFree(void *ptr) {
 }
 
 size_t MemoryPool::blockIndexByAddress(void *ptr) {
-    return (static_cast<char *>(ptr) - memoryPtr) / blockSize;
+    return (static_cast<char *>(ptr) - memoryPtr) / frameSize;
 }
 
 char *MemoryPool::blockAddressByIndex(size_t index) {
-    return memoryPtr + index * blockSize;
+    return memoryPtr + index * frameSize;
 }
 
 void MemoryPool::lockBlock(void *ptr) {
@@ -132,31 +320,134 @@ void MemoryPool::lockBlock(void *ptr) {
     stat.lockedCounter++;
 }
 
+bool MemoryPool::tryLockBlock(void *ptr) {
+    std::unique_lock<std::mutex> ul(blockMutex);
+    if (blockIsLocked.at(blockIndexByAddress(ptr)) != 0)
+        return false;
+    blockIsLocked.at(blockIndexByAddress(ptr)) = 1;
+    ul.unlock();
+    stat.lockedCounter++;
+    return true;
+}
+
 void MemoryPool::unlockBlock(void *ptr) {
     std::unique_lock<std::mutex> ul(blockMutex);
     blockIsLocked.at(blockIndexByAddress(ptr)) = 0;
-    conditionVariable.notify_one();
+    // waiters can wait for different blocks, so wake up all of them
+    conditionVariable.notify_all();
     ul.unlock();
     stat.lockedCounter--;
 }
 
+// the swap lock can be held across I/O, then the hint is just dropped
+void MemoryPool::readAhead(size_t blockIndex, SwapIdType id) {
+    std::unique_lock<std::mutex> swapGuard(swapMutex, std::try_to_lock);
+    if (swapGuard.owns_lock())
+        diskSwap->ReadAhead(blockIndex, id);
+}
+
+void MemoryPool::readBlock(size_t blockIndex, SwapIdType id, void *data,
+                           size_t size) {
+    std::lock_guard<std::mutex> swapGuard(swapMutex);
+    diskSwap->ReadBlockData(blockIndex, id, data, size);
+}
+
+void MemoryPool::loadBlocks(const std::vector<FrameLoad> &blocks) {
+    std::lock_guard<std::mutex> swapGuard(swapMutex);
+    for (const auto &[blockIndex, id, tenant] : blocks) {
+        // an empty ram block (persistent swap) is not swapped out on load
+        bool empty = diskSwap->isRamSlotEmpty(blockIndex);
+        if (empty)
+            stat.swappedCounter--;
+        if (!diskSwap->isBlockInRam(blockIndex, id)) {
+            tenants.CountSwapIn(tenant);
+            if (!empty) {
+                stat.swapOutCounter++;
+                tenants.CountSwapOut(frameTenant[blockIndex]);
+            }
+        }
+        diskSwap->LoadBlockIntoRam(blockIndex, id);
+        chargeFrame(blockIndex, tenant);
+    }
+}
+
+static uint64_t ShareKey(size_t blockIndex, SwapIdType id) {
+    return (uint64_t(blockIndex) << 8) | id;
+}
+
+void MemoryPool::shareBlock(size_t blockIndex, SwapIdType id) {
+    std::lock_guard<std::mutex> guard(shareMutex);
+    size_t &count = shareCount[ShareKey(blockIndex, id)];
+    if (count == 0) {
+        count = 1;
+        numShared++;
+    }
+    ++count;
+}
+
+bool MemoryPool::isShared(size_t blockIndex, SwapIdType id) {
+    if (numShared == 0)
+        return false;
+    std::lock_guard<std::mutex> guard(shareMutex);
+    return shareCount.count(ShareKey(blockIndex, id)) != 0;
+}
+
+bool MemoryPool::releaseShared(size_t blockIndex, SwapIdType id) {
+    if (numShared == 0)
+        return false;
+    std::lock_guard<std::mutex> guard(shareMutex);
+    auto it = shareCount.find(ShareKey(blockIndex, id));
+    if (it == end(shareCount))
+        return false;
+    if (--it->second == 1) {
+        shareCount.erase(it);
+        numShared--;
+    }
+    return true;
+}
+
 void MemoryPool::freeBlock(void *ptr, SwapIdType id) {
     std::lock_guard<std::mutex> poolGuard(poolMutex);
+    size_t blockIndex = blockIndexByAddress(ptr);
+    {
+        // A swapped out block doesn't need its ram block, which can be
+        // pinned by another block meanwhile (PinSet relocates blocks away
+        // from pinned ones). Only a block which can free an empty ram
+        // block waits for it.
+        std::lock_guard<std::mutex> swapGuard(swapMutex);
+        if (diskSwap->isBlockInSwap(blockIndex, id) &&
+            !diskSwap->isRamSlotEmpty(blockIndex)) {
+            diskSwap->MarkBlockFreed(blockIndex, id);
+            stat.swappedCounter--;
+            return;
+        }
+    }
     lockBlock(ptr);
     swapMutex.lock();
-    size_t blockIndex = blockIndexByAddress(ptr);
     if (diskSwap->isBlockInSwap(blockIndex, id)) {
         // it's in swap, let's just mark it freed (in swapTable)
         diskSwap->MarkBlockFreed(blockIndex, id);
         stat.swappedCounter--;
+        // a ram block restored from a persistent swap can be empty, it's
+        // free when its last swapped block is gone
+        if (diskSwap->isRamSlotEmpty(blockIndex) &&
+            !diskSwap->HasSwappedBlocks(blockIndex)) {
+            privateFree(ptr);
+            chargeFrame(blockIndex, NO_TENANT);
+            stat.usedCounter--;
+        }
     } else {
         // it's it ram
         if (diskSwap->HasSwappedBlocks(blockIndex)) {
+            // the owner of the returned block is not known, it's charged to
+            // the default tenant until the block is locked
             diskSwap->ReturnLastSwappedBlockIntoRam(blockIndex);
+            chargeFrame(blockIndex, 0);
             stat.swappedCounter--;
         } else {
             privateFree(ptr);
             diskSwap->MarkBlockFreed(blockIndex, id);
+            chargeFrame(blockIndex, NO_TENANT);
             stat.usedCounter--;
         }
     }
@@ -166,7 +457,6 @@ void MemoryPool::freeBlock(void *ptr, SwapIdType id) {
 
 const PoolStat &MemoryPool::getStatistics() const { return stat; }
 
-size_t MemoryPool::getNumBlocks() const {
-    std::lock_guard<std::mutex> poolGuard(poolMutex);
-    return numBlocks;
-}
+// numBlocks never changes after the constructor, so monitoring can read
+// it without waiting for allocations
+size_t MemoryPool::getNumBlocks() const { return numBlocks; }
@@ -3,19 +3,49 @@
 #include <atomic>
 #include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <mutex>
-#include <queue>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "../utils/logger.hpp"
+#include "../utils/sharded_counter.hpp"
+#include "../utils/zeroed_allocator.hpp"
 #include "memory_block.hpp"
+#include "miss_ratio_curve.hpp"
 #include "swap.hpp"
+#include "tenants.hpp"
 
+// Counters are updated on every lock() and allocation, so each of them is
+// sharded between threads and summed only when statistics are read
 struct PoolStat {
-    std::atomic<size_t> usedCounter = 0;
-    std::atomic<size_t> lockedCounter = 0;
-    std::atomic<size_t> swappedCounter = 0;
+    utils::ShardedCounter usedCounter;
+    utils::ShardedCounter lockedCounter;
+    utils::ShardedCounter swappedCounter;
     std::atomic<size_t> swapLevels = 0;
+    utils::ShardedCounter demotedCounter;
+    utils::ShardedCounter accessCounter;  // lock() calls
+    utils::ShardedCounter swapInCounter;  // of them loaded from swap
+    utils::ShardedCounter swapOutCounter; // ram blocks written to swap
+};
+
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+// Layout of ram blocks of the pools of a manager
+struct PoolConfig {
+    // Ram blocks of classes smaller than a cache line take a whole line, so
+    // blocks used by different threads never share one. The 16 bytes class
+    // then takes 4 times more memory (it's counted in the memory limit).
+    bool isolateFrames = false;
+};
+
+// A block to bring into its ram block
+struct FrameLoad {
+    size_t frame;
+    SwapIdType id;
+    size_t tenant;
 };
 
 // --------------------------------------------------------
@@ -24,40 +54,96 @@ struct PoolStat {
 class MemoryPool {
     friend class MemoryBlock;
     friend class DiskSwap;
+    size_t index; // in the pool registry
     size_t numBlocks;
     size_t blockSize;
+    size_t frameSize; // distance between ram blocks, blockSize or more
     size_t totalSize;
     char *memoryPtr;
-    char *nextBlock;
+    char *nextBlock;   // list of freed ram blocks
+    size_t numTouched; // ram blocks from this one on were never used
     mutable std::mutex poolMutex;
     std::mutex swapMutex;
 
     std::mutex blockMutex;
     std::condition_variable conditionVariable;
-    std::vector<bool> blockIsLocked;
+    // tables by ram block are zero pages until the ram block is touched
+    utils::ZeroedVector<uint8_t> blockIsLocked;
 
-    std::queue<size_t> swapQueue;
+    // ram blocks in the order of allocation, the oldest is evicted first
+    // unless tenants have quotas. A ram block which is freed and allocated
+    // again is pushed again, only its last entry counts (the older ones
+    // are skipped while queueEntries > 1), and the queue is compacted when
+    // it's twice as long as the pool.
+    std::deque<uint32_t> swapQueue;
+    utils::ZeroedVector<uint8_t> queueEntries;
+    // tenant of the block in each ram block, NO_TENANT if it's empty (set
+    // when the ram block is touched for the first time)
+    utils::ZeroedVector<std::atomic<uint8_t>> frameTenant;
+
+    // number of handles of blocks shared by clones by (frame, id), blocks
+    // with one handle are not here
+    std::mutex shareMutex;
+    std::unordered_map<uint64_t, size_t> shareCount;
+    std::atomic<size_t> numShared = 0; // entries in shareCount
 
     DiskSwap *diskSwap;
+    MissRatioCurve &missRatioCurve; // shared by pools of a manager
+    TenantTable &tenants;           // shared by pools of a manager
     PoolStat stat;
 
     void *privateAlloc();
     void privateFree(void *ptr);
 
+    size_t pickVictim(size_t requester);
+    void enqueueFrame(size_t blockIndex);
+    void compactSwapQueue();
+    void chargeFrame(size_t blockIndex, size_t tenant);
+
     size_t blockIndexByAddress(void *ptr);
     char *blockAddressByIndex(size_t index);
 
   public:
-    MemoryPool(size_t numBlocks, size_t blockSize);
+    // Bytes of pool tables per ram frame: lock flag, tenant, up to two swap
+    // queue entries and their count, ids of ram and the first swap level.
+    // It's counted in the memory limit. Tables which grow with the swap
+    // (ids of next levels, checksums, queues of tiers) or with clones, and
+    // state of a fixed size are not.
+    static constexpr size_t METADATA_PER_FRAME =
+        3 + 2 * sizeof(uint32_t) + 2 * sizeof(SwapIdType);
+
+    // Throws std::bad_alloc if the process has 2^POOL_INDEX_BITS - 1 pools
+    // already (they are found by index from MemoryBlock)
+    MemoryPool(size_t numBlocks, size_t blockSize, SwapSpace &space,
+               MissRatioCurve &curve, TenantTable &tenants,
+               const PoolConfig &config = PoolConfig{});
+    // Ram bytes taken by one block of the class
+    static size_t FrameSize(size_t blockSize, const PoolConfig &config);
     MemoryPool(const MemoryPool &) = delete;
     MemoryPool &operator=(const MemoryPool &) = delete;
     ~MemoryPool();
 
     void lockBlock(void *ptr);
+    bool tryLockBlock(void *ptr);
     void unlockBlock(void *ptr);
 
     MemoryBlock getBlock(size_t size);
+    MemoryBlock attachBlock(const BlockHandle &handle);
     void freeBlock(void *ptr, SwapIdType id);
+    void readBlock(size_t blockIndex, SwapIdType id, void *data, size_t size);
+    // Hints that a swapped out block will be loaded soon, never waits
+    void readAhead(size_t blockIndex, SwapIdType id);
+    // Loads blocks into their locked ram blocks
+    void loadBlocks(const std::vector<FrameLoad> &blocks);
+
+    // Reference counting of blocks shared by clones: shareBlock() adds a
+    // handle, releaseShared() removes one and returns false if it was the
+    // only handle (so the block is to be freed or written as usual).
+    void shareBlock(size_t blockIndex, SwapIdType id);
+    bool isShared(size_t blockIndex, SwapIdType id);
+    bool releaseShared(size_t blockIndex, SwapIdType id);
+
+    static MemoryPool *byIndex(size_t index);
 
     size_t getNumBlocks() const;
     const PoolStat &getStatistics() const;
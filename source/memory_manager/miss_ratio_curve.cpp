@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "miss_ratio_curve.hpp"
+
+// hashes are compared in this range, threshold == HASH_RANGE samples all
+static const uint64_t HASH_BITS = 24;
+static const uint64_t HASH_RANGE = uint64_t(1) << HASH_BITS;
+
+// distances below the first limit share bucket 0, then every power of two
+// is split into BUCKETS_PER_OCTAVE buckets
+static const double FIRST_BUCKET_LIMIT = 1024;
+static const size_t BUCKETS_PER_OCTAVE = 4;
+static const size_t NUM_BUCKETS = 1 + 40 * BUCKETS_PER_OCTAVE;
+
+static uint64_t Hash(uint64_t key) {
+    // splitmix64 finalizer
+    key += 0x9e3779b97f4a7c15ULL;
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    key = key ^ (key >> 31);
+    return key >> (64 - HASH_BITS);
+}
+
+// --------------------------------------------------------
+// class MissRatioCurve
+// --------------------------------------------------------
+MissRatioCurve::MissRatioCurve(size_t maxSamples)
+    : maxSamples(maxSamples), threshold(HASH_RANGE),
+      tree(4 * maxSamples + 2, 0), histogram(NUM_BUCKETS, 0) {}
+
+void MissRatioCurve::Add(uint64_t time, int64_t bytes) {
+    for (; time < tree.size(); time += time & (~time + 1))
+        tree[time] += bytes;
+}
+
+int64_t MissRatioCurve::Sum(uint64_t time) const {
+    int64_t sum = 0;
+    for (; time > 0; time -= time & (~time + 1))
+        sum += tree[time];
+    return sum;
+}
+
+double MissRatioCurve::Rate() const {
+    return static_cast<double>(threshold.load()) / HASH_RANGE;
+}
+
+size_t MissRatioCurve::Bucket(double distance) {
+    if (distance < FIRST_BUCKET_LIMIT)
+        return 0;
+    size_t bucket = 1 + static_cast<size_t>(BUCKETS_PER_OCTAVE *
+                                            std::log2(distance /
+                                                      FIRST_BUCKET_LIMIT));
+    return std::min(bucket, NUM_BUCKETS - 1);
+}
+
+// upper limit of distances in a bucket
+double MissRatioCurve::BucketLimit(size_t bucket) {
+    return FIRST_BUCKET_LIMIT *
+           std::exp2(static_cast<double>(bucket) / BUCKETS_PER_OCTAVE);
+}
+
+void MissRatioCurve::Access(uint64_t key, size_t bytes) {
+    uint64_t hash = Hash(key);
+    if (hash >= threshold.load(std::memory_order_relaxed))
+        return;
+
+    std::lock_guard<std::mutex> guard(mutex);
+    if (hash >= threshold.load(std::memory_order_relaxed))
+        return;
+
+    const double weight = 1.0 / Rate();
+    accesses += weight;
+    auto it = samples.find(key);
+    if (it == samples.end()) {
+        it = samples.emplace(key, Sample{hash, 0, 0}).first;
+        byHash.emplace(hash, key);
+    } else {
+        // bytes of blocks accessed after the previous access of this one
+        int64_t distance = Sum(now - 1) - Sum(it->second.time);
+        histogram[Bucket(distance * weight)] += weight;
+        Add(it->second.time, -static_cast<int64_t>(it->second.bytes));
+    }
+    it->second.time = now;
+    it->second.bytes = static_cast<uint32_t>(bytes);
+    Add(now, static_cast<int64_t>(bytes));
+    ++now;
+
+    if (samples.size() > maxSamples)
+        LowerThreshold();
+    if (now >= tree.size())
+        Compact();
+}
+
+void MissRatioCurve::Forget(uint64_t key) {
+    uint64_t hash = Hash(key);
+    if (hash >= threshold.load(std::memory_order_relaxed))
+        return;
+
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = samples.find(key);
+    if (it == samples.end())
+        return;
+    Add(it->second.time, -static_cast<int64_t>(it->second.bytes));
+    byHash.erase({it->second.hash, key});
+    samples.erase(it);
+}
+
+// Renumbers times of samples from 1, they keep their order
+void MissRatioCurve::Compact() {
+    std::vector<Sample *> order;
+    order.reserve(samples.size());
+    for (auto &[key, sample] : samples)
+        order.push_back(&sample);
+    std::sort(begin(order), end(order), [](const Sample *a, const Sample *b) {
+        return a->time < b->time;
+    });
+
+    std::fill(begin(tree), end(tree), 0);
+    now = 1;
+    for (Sample *sample : order) {
+        sample->time = now++;
+        Add(sample->time, sample->bytes);
+    }
+}
+
+void MissRatioCurve::LowerThreshold() {
+    while (samples.size() > maxSamples) {
+        uint64_t newThreshold = byHash.rbegin()->first;
+        while (!byHash.empty() && byHash.rbegin()->first >= newThreshold) {
+            uint64_t key = byHash.rbegin()->second;
+            auto it = samples.find(key);
+            Add(it->second.time, -static_cast<int64_t>(it->second.bytes));
+            samples.erase(it);
+            byHash.erase(std::prev(byHash.end()));
+        }
+        threshold.store(newThreshold);
+    }
+}
+
+double MissRatioCurve::Ratio(size_t ramBytes) const {
+    if (accesses == 0)
+        return 0;
+
+    const double ram = static_cast<double>(ramBytes);
+    double misses = 0;
+    double lower = 0;
+    for (size_t bucket = 0; bucket < NUM_BUCKETS; ++bucket) {
+        double upper = BucketLimit(bucket);
+        if (lower >= ram) {
+            misses += histogram[bucket];
+        } else if (upper > ram) {
+            // distances are assumed to be spread evenly in a bucket
+            misses += histogram[bucket] * (upper - ram) / (upper - lower);
+        }
+        lower = upper;
+    }
+    return std::min(1.0, misses / accesses);
+}
+
+double MissRatioCurve::MissRatio(size_t ramBytes) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return Ratio(ramBytes);
+}
+
+bool MissRatioCurve::TryRead(const size_t *ramBytes, size_t count,
+                             double *ratios, size_t &workingSet) const {
+    std::unique_lock<std::mutex> ul(mutex, std::try_to_lock);
+    if (!ul.owns_lock())
+        return false;
+    for (size_t i = 0; i < count; ++i)
+        ratios[i] = Ratio(ramBytes[i]);
+    workingSet = static_cast<size_t>(Sum(now - 1) / Rate());
+    return true;
+}
+
+size_t MissRatioCurve::WorkingSetBytes() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return static_cast<size_t>(Sum(now - 1) / Rate());
+}
+
+size_t MissRatioCurve::SampledAccesses() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return static_cast<size_t>(accesses * Rate());
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// --------------------------------------------------------
+// class MissRatioCurve
+//
+// Online estimation of the miss ratio curve (share of block accesses
+// which would need a swap-in) as a function of RAM size, for an LRU
+// cache of blocks. It uses fixed-size SHARDS: only blocks whose hash is
+// below a threshold are tracked, reuse distances (bytes of distinct
+// blocks accessed since the previous access of the same block) are
+// measured on the sample and scaled by the sampling rate. When too many
+// blocks are sampled the threshold is lowered and the largest hashes are
+// dropped, so memory use is bounded. The first access of a block is not
+// a miss: new blocks are created in ram.
+// --------------------------------------------------------
+class MissRatioCurve {
+    struct Sample {
+        uint64_t hash;
+        uint64_t time;
+        uint32_t bytes;
+    };
+
+    const size_t maxSamples;
+    std::atomic<uint64_t> threshold; // sampled if hash < threshold
+    mutable std::mutex mutex;
+
+    std::unordered_map<uint64_t, Sample> samples; // by block key
+    std::set<std::pair<uint64_t, uint64_t>> byHash; // hash, key
+
+    // Fenwick tree of sampled bytes by logical time of the last access
+    std::vector<int64_t> tree;
+    uint64_t now = 1;
+
+    // counts of scaled reuse distances in logarithmic buckets
+    std::vector<double> histogram;
+    double accesses = 0;
+
+    void Add(uint64_t time, int64_t bytes);
+    int64_t Sum(uint64_t time) const; // of [1, time]
+    void Compact();
+    void LowerThreshold();
+    double Rate() const;
+    double Ratio(size_t ramBytes) const; // under the lock
+
+    static size_t Bucket(double distance);
+    static double BucketLimit(size_t bucket);
+
+  public:
+    explicit MissRatioCurve(size_t maxSamples = 8192);
+
+    // Called on every access of a block, cheap for blocks out of sample
+    void Access(uint64_t key, size_t bytes);
+    // Called when a block is freed, it leaves the working set
+    void Forget(uint64_t key);
+
+    // Predicted share of accesses which miss a RAM of `ramBytes`
+    double MissRatio(size_t ramBytes) const;
+    // Estimated bytes of live blocks accessed so far
+    size_t WorkingSetBytes() const;
+    // MissRatio() of `count` sizes and WorkingSetBytes() under one lock.
+    // Returns false without waiting if an access holds the lock.
+    bool TryRead(const size_t *ramBytes, size_t count, double *ratios,
+                 size_t &workingSet) const;
+    size_t SampledAccesses() const;
+};
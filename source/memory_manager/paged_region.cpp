@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "paged_region.hpp"
+
+static const size_t MIN_RESIDENT_PAGES = 16;
+
+// Faults of system calls are handled only for privileged processes,
+// others get a descriptor for faults in user mode
+static int OpenUserfaultfd(bool &userModeOnly) {
+    int fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    userModeOnly = false;
+    if (fd < 0 && errno == EPERM) {
+        fd = syscall(SYS_userfaultfd,
+                     O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+        userModeOnly = true;
+    }
+    return fd;
+}
+
+static void CheckIoctl(int result, const char *name) {
+    if (result != 0) {
+        std::cerr << "Error: PagedRegion " << name
+                  << " failed: " << std::strerror(errno) << std::endl;
+        exit(1);
+    }
+}
+
+// --------------------------------------------------------
+// class PagedRegion
+// --------------------------------------------------------
+PagedRegion::PagedRegion(size_t size, size_t ramLimit, MemoryManager &manager)
+    : manager(&manager), pageSize(sysconf(_SC_PAGESIZE)) {
+    if (manager.maxBlockSize() < pageSize) {
+        throw std::invalid_argument("PagedRegion: a page of " +
+                                    std::to_string(pageSize) +
+                                    " bytes doesn't fit into a block");
+    }
+    numPages = std::max<size_t>(1, (size + pageSize - 1) / pageSize);
+    maxResident = std::max(MIN_RESIDENT_PAGES, ramLimit / pageSize);
+    states.assign(numPages, Missing);
+    copies.resize(numPages);
+    zeroPage.assign(pageSize, 0);
+
+    auto fail = [this](const char *what) {
+        int error = errno;
+        Close();
+        throw std::system_error(error, std::generic_category(),
+                                std::string("PagedRegion: ") + what);
+    };
+
+    void *address = mmap(nullptr, numPages * pageSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (address == MAP_FAILED)
+        fail("mmap()");
+    base = static_cast<char *>(address);
+    // faults must come for single pages, not for huge ones
+    madvise(base, numPages * pageSize, MADV_NOHUGEPAGE);
+
+    uffd = OpenUserfaultfd(userModeOnly);
+    if (uffd < 0)
+        fail("userfaultfd()");
+    uffdio_api api{};
+    api.api = UFFD_API;
+    api.features = UFFD_FEATURE_PAGEFAULT_FLAG_WP;
+    if (ioctl(uffd, UFFDIO_API, &api) != 0)
+        fail("UFFDIO_API, write protection is not supported");
+
+    uffdio_register range{};
+    range.range.start = reinterpret_cast<uintptr_t>(base);
+    range.range.len = numPages * pageSize;
+    range.mode = UFFDIO_REGISTER_MODE_MISSING | UFFDIO_REGISTER_MODE_WP;
+    if (ioctl(uffd, UFFDIO_REGISTER, &range) != 0)
+        fail("UFFDIO_REGISTER");
+    const uint64_t needed = (uint64_t(1) << _UFFDIO_COPY) |
+                            (uint64_t(1) << _UFFDIO_WAKE) |
+                            (uint64_t(1) << _UFFDIO_WRITEPROTECT);
+    if ((range.ioctls & needed) != needed) {
+        errno = ENOTSUP;
+        fail("UFFDIO_REGISTER, no write protection for anonymous memory");
+    }
+
+    stopFd = eventfd(0, EFD_CLOEXEC);
+    if (stopFd < 0)
+        fail("eventfd()");
+    handler = std::thread(&PagedRegion::Run, this);
+}
+
+PagedRegion::~PagedRegion() {
+    uint64_t one = 1;
+    if (write(stopFd, &one, sizeof(one)) != sizeof(one))
+        std::cerr << "Error: can't stop the PagedRegion handler" << std::endl;
+    handler.join();
+    Close();
+    for (MemoryBlock &copy : copies) {
+        if (copy.capacity() != 0)
+            copy.free();
+    }
+}
+
+void PagedRegion::Close() {
+    if (stopFd >= 0)
+        close(stopFd);
+    if (uffd >= 0)
+        close(uffd);
+    if (base != nullptr)
+        munmap(base, numPages * pageSize);
+    stopFd = uffd = -1;
+    base = nullptr;
+}
+
+PagedRegionCounters PagedRegion::counters() const {
+    PagedRegionCounters counters;
+    counters.faults = stat.faults;
+    counters.writeFaults = stat.writeFaults;
+    counters.zeroFills = stat.zeroFills;
+    counters.pageIns = stat.pageIns;
+    counters.pageOuts = stat.pageOuts;
+    counters.cleanDrops = stat.cleanDrops;
+    counters.resident =
+        counters.zeroFills + counters.pageIns - counters.pageOuts -
+        counters.cleanDrops;
+    return counters;
+}
+
+// The handler thread: faults are read in batches until the destructor
+// signals stopFd
+void PagedRegion::Run() {
+    pollfd fds[2] = {{uffd, POLLIN, 0}, {stopFd, POLLIN, 0}};
+    uffd_msg messages[16];
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            CheckIoctl(-1, "poll()");
+        }
+        if (fds[1].revents != 0)
+            return;
+        ssize_t n = read(uffd, messages, sizeof(messages));
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            CheckIoctl(-1, "read()");
+        }
+        for (size_t i = 0; i < n / sizeof(uffd_msg); ++i) {
+            if (messages[i].event == UFFD_EVENT_PAGEFAULT) {
+                HandleFault(messages[i].arg.pagefault.address,
+                            messages[i].arg.pagefault.flags);
+            }
+        }
+    }
+}
+
+// A fault can be stale: several threads touch one page, or a page is
+// evicted after a thread has hit its write protection. Such threads are
+// just woken up to retry the access.
+void PagedRegion::HandleFault(uint64_t address, uint64_t flags) {
+    size_t page = (address - reinterpret_cast<uintptr_t>(base)) / pageSize;
+    if (flags & UFFD_PAGEFAULT_FLAG_WP) {
+        stat.writeFaults++;
+        if (states[page] == Clean) {
+            // the copy is out of date from now on
+            states[page] = Dirty;
+            if (copies[page].capacity() != 0)
+                copies[page].free();
+            copies[page] = MemoryBlock();
+            WriteProtect(page, false); // wakes the writer up
+        } else {
+            Wake(page);
+        }
+        return;
+    }
+
+    stat.faults++;
+    if (states[page] != Missing) {
+        Wake(page);
+        return;
+    }
+    while (resident.size() >= maxResident) {
+        EvictPage(resident.front());
+        resident.pop_front();
+    }
+    LoadPage(page, flags & UFFD_PAGEFAULT_FLAG_WRITE);
+    resident.push_back(page);
+}
+
+// A page is loaded write-protected unless it's loaded for a write
+void PagedRegion::LoadPage(size_t page, bool write) {
+    MemoryBlock &copy = copies[page];
+    const bool hasCopy = copy.capacity() != 0;
+    if (hasCopy)
+        copy.lockReadOnly();
+
+    uffdio_copy request{};
+    request.dst = reinterpret_cast<uintptr_t>(base + page * pageSize);
+    request.src = reinterpret_cast<uintptr_t>(
+        hasCopy ? static_cast<const char *>(copy.data<const char>())
+                : zeroPage.data());
+    request.len = pageSize;
+    request.mode = write ? 0 : UFFDIO_COPY_MODE_WP;
+    int result = 0;
+    do {
+        result = ioctl(uffd, UFFDIO_COPY, &request);
+    } while (result != 0 && errno == EAGAIN);
+    CheckIoctl(result, "UFFDIO_COPY");
+
+    if (hasCopy) {
+        copy.unlock();
+        stat.pageIns++;
+    } else {
+        stat.zeroFills++;
+    }
+    if (write && hasCopy) {
+        copy.free();
+        copy = MemoryBlock();
+    }
+    states[page] = write ? Dirty : Clean;
+}
+
+// A dirty page is write-protected before it's copied, so writers wait
+// until it's dropped and then fault it in again
+void PagedRegion::EvictPage(size_t page) {
+    char *address = base + page * pageSize;
+    if (states[page] == Dirty) {
+        WriteProtect(page, true);
+        MemoryBlock copy = manager->getBlock(pageSize);
+        std::memcpy(copy.data<char>(), address, pageSize);
+        copies[page] = std::move(copy);
+        stat.pageOuts++;
+    } else {
+        stat.cleanDrops++;
+    }
+    CheckIoctl(madvise(address, pageSize, MADV_DONTNEED), "madvise()");
+    states[page] = Missing;
+}
+
+void PagedRegion::WriteProtect(size_t page, bool protect) {
+    uffdio_writeprotect request{};
+    request.range.start = reinterpret_cast<uintptr_t>(base + page * pageSize);
+    request.range.len = pageSize;
+    request.mode = protect ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+    CheckIoctl(ioctl(uffd, UFFDIO_WRITEPROTECT, &request),
+               "UFFDIO_WRITEPROTECT");
+}
+
+void PagedRegion::Wake(size_t page) {
+    uffdio_range range{};
+    range.start = reinterpret_cast<uintptr_t>(base + page * pageSize);
+    range.len = pageSize;
+    CheckIoctl(ioctl(uffd, UFFDIO_WAKE, &range), "UFFDIO_WAKE");
+}
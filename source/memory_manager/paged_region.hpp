@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "memory_manager.hpp"
+
+// Totals of a region, pages are counted on every transfer
+struct PagedRegionCounters {
+    size_t faults = 0;      // missing pages touched by the program
+    size_t writeFaults = 0; // first writes to clean pages
+    size_t zeroFills = 0;   // pages touched for the first time
+    size_t pageIns = 0;     // pages loaded from the manager
+    size_t pageOuts = 0;    // dirty pages given to the manager
+    size_t cleanDrops = 0;  // evicted pages which had a copy already
+    size_t resident = 0;    // pages in ram now
+};
+
+// --------------------------------------------------------
+// class PagedRegion (Linux only)
+//
+// A range of plain virtual memory for code which wants raw pointers
+// instead of MemoryBlock. Only `ramLimit` bytes of it are kept in ram,
+// other pages live in blocks of the manager (so in its pools and swap
+// files) and are brought back by a handler thread of the region when
+// the program touches them, through userfaultfd:
+//
+//     PagedRegion region(1ull << 30, 64 << 20);
+//     char *data = region.data(); // any pointer arithmetic is fine
+//
+// Pages come in write-protected, so the first write to a page is seen
+// and only written pages are copied out on eviction. The oldest page is
+// evicted first: it's write-protected, copied into a block of the
+// manager and dropped with MADV_DONTNEED. Threads which touch a page
+// while it's being evicted wait for the handler. Pages must fit into the
+// largest block of the manager.
+//
+// Without CAP_SYS_PTRACE (and vm.unprivileged_userfaultfd = 0) only faults
+// of the program itself are handled: system calls like read() into a page
+// which is not in ram fail with EFAULT, see kernelAccess(). The
+// constructor throws std::system_error if userfaultfd or its write
+// protection is not available.
+// --------------------------------------------------------
+class PagedRegion {
+    enum PageState : uint8_t { Missing, Clean, Dirty };
+
+    MemoryManager *manager;
+    size_t pageSize;
+    size_t numPages;
+    size_t maxResident;
+    char *base = nullptr;
+    int uffd = -1;
+    int stopFd = -1;
+    bool userModeOnly = false;
+
+    // owned by the handler thread
+    std::vector<PageState> states;
+    std::vector<MemoryBlock> copies; // last copy of a page, if it has one
+    std::deque<size_t> resident;     // in order of loading
+    std::vector<char> zeroPage;
+
+    struct {
+        std::atomic<size_t> faults = 0;
+        std::atomic<size_t> writeFaults = 0;
+        std::atomic<size_t> zeroFills = 0;
+        std::atomic<size_t> pageIns = 0;
+        std::atomic<size_t> pageOuts = 0;
+        std::atomic<size_t> cleanDrops = 0;
+    } stat;
+
+    std::thread handler;
+
+    void Run();
+    void HandleFault(uint64_t address, uint64_t flags);
+    void LoadPage(size_t page, bool write);
+    void EvictPage(size_t page);
+    void WriteProtect(size_t page, bool protect);
+    void Wake(size_t page);
+    void Close();
+
+  public:
+    // Reserves `size` bytes (rounded up to pages) of address space, at most
+    // `ramLimit` of them are in ram at a time (but no less than 16 pages,
+    // as one instruction can touch several pages)
+    PagedRegion(size_t size, size_t ramLimit,
+                MemoryManager &manager = memoryManager);
+    PagedRegion(const PagedRegion &) = delete;
+    PagedRegion &operator=(const PagedRegion &) = delete;
+    ~PagedRegion();
+
+    char *data() const { return base; }
+    size_t size() const { return numPages * pageSize; }
+    // false if system calls can't fault pages in
+    bool kernelAccess() const { return !userModeOnly; }
+    PagedRegionCounters counters() const;
+};
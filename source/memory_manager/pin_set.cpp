@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <map>
+#include <utility>
+
+#include "memory_pool.hpp"
+#include "pin_set.hpp"
+
+// pool index and frame index of a block
+using FrameKey = std::pair<size_t, size_t>;
+
+// Attempts to get a ram block which is not used by the set
+static const size_t MAX_RELOCATE_ATTEMPTS = 16;
+
+// --------------------------------------------------------
+// class PinSet
+// --------------------------------------------------------
+PinSet::PinSet(std::initializer_list<MemoryBlock *> blocks, Policy policy,
+               Access access)
+    : PinSet(blocks.begin(), blocks.size(), policy, access) {}
+
+PinSet::PinSet(MemoryBlock *const *blocks, size_t count, Policy policy,
+               Access access) {
+    std::vector<MemoryBlock *> set(blocks, blocks + count);
+    std::sort(begin(set), end(set));
+    set.erase(std::unique(begin(set), end(set)), end(set));
+
+    std::map<size_t, size_t> perPool;
+    for (MemoryBlock *block : set) {
+        block->checkScopeError();
+        MemoryPool *pool = block->pool();
+        if (++perPool[block->poolIndex()] > pool->getNumBlocks())
+            throw PinSetError("PinSet: more blocks than ram blocks in a pool");
+    }
+
+    // Blocks locked by the caller hold their ram blocks already, so they
+    // are placed first and the others are moved away from them.
+    std::stable_partition(begin(set), end(set), [](MemoryBlock *block) {
+        return block->isLocked();
+    });
+    std::map<FrameKey, MemoryBlock *> frames;
+    for (MemoryBlock *block : set) {
+        if (access == Access::Write)
+            block->makeWritable(); // even if the caller pinned it read-only
+        FrameKey key{block->poolIndex(), block->frameIndex()};
+        if (frames.count(key) != 0) {
+            if (block->isLocked() || policy == Policy::FailFast)
+                throw PinSetError("PinSet: blocks share one ram block");
+            relocate(*block, frames);
+            key = FrameKey{block->poolIndex(), block->frameIndex()};
+        }
+        frames[key] = block;
+    }
+
+    try {
+        // lock ram blocks in the global order
+        for (auto &[key, block] : frames) {
+            if (!block->isLocked()) {
+                block->pool()->lockBlock(block->ptr());
+                pinned.push_back(block);
+            }
+        }
+
+        // swap blocks in, one swap lock per pool
+        for (size_t first = 0; first < pinned.size();) {
+            MemoryPool *pool = pinned[first]->pool();
+            std::vector<FrameLoad> loads;
+            size_t last = first;
+            for (; last < pinned.size() && pinned[last]->pool() == pool;
+                 ++last) {
+                const MemoryBlock &block = *pinned[last];
+                loads.push_back({block.frameIndex(),
+                                 static_cast<SwapIdType>(block.f_.id),
+                                 block.f_.tenant});
+            }
+            pool->loadBlocks(loads);
+            first = last;
+        }
+    } catch (...) {
+        // the destructor doesn't run, and the blocks aren't marked yet
+        for (MemoryBlock *block : pinned)
+            block->pool()->unlockBlock(block->ptr());
+        pinned.clear();
+        throw;
+    }
+    for (MemoryBlock *block : pinned) {
+        block->f_.locked = true;
+        block->recordAccess();
+    }
+}
+
+// Moves the block into a ram block of its pool which is not in `frames`
+void PinSet::relocate(MemoryBlock &block,
+                      const std::map<FrameKey, MemoryBlock *> &frames) {
+    MemoryPool *pool = block.pool();
+    std::vector<MemoryBlock> rejected;
+    MemoryBlock moved;
+    for (size_t attempt = 0; attempt < MAX_RELOCATE_ATTEMPTS; ++attempt) {
+        MemoryBlock candidate = pool->getBlock(block.size());
+        if (frames.count(FrameKey{candidate.poolIndex(),
+                                  candidate.frameIndex()}) == 0) {
+            moved = std::move(candidate);
+            break;
+        }
+        rejected.push_back(std::move(candidate));
+    }
+    for (MemoryBlock &candidate : rejected)
+        candidate.free();
+    if (moved.poolIndex() == 0)
+        throw PinSetError("PinSet: can't find a free ram block to relocate");
+
+    // only blocks locked by the caller are pinned yet, and getBlock()
+    // doesn't pick their ram blocks, so `moved` isn't one of them
+    moved.lock();
+    pool->readBlock(block.frameIndex(), block.f_.id, moved.ptr(),
+                    block.size());
+    moved.unlock();
+    block.free();
+    block = std::move(moved);
+}
+
+void PinSet::release() {
+    for (MemoryBlock *block : pinned)
+        block->unlock();
+    pinned.clear();
+}
+
+PinSet::~PinSet() { release(); }
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <initializer_list>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "memory_block.hpp"
+
+// --------------------------------------------------------
+// class PinSet
+//
+// Pins several blocks at once for the lifetime of the guard, e.g. to
+// memcpy between them:
+//
+//     PinSet pins{&a, &b};
+//     std::memcpy(a.data(), b.data(), b.size());
+//
+// Ram blocks are locked in one global order (pool, frame), so guards of
+// different threads can't deadlock each other, and all swap-ins of a pool
+// are done under one swap lock. Blocks locked by the caller before are
+// left locked.
+//
+// Two blocks sharing one ram block can't be in ram together. With
+// FailFast the constructor throws PinSetError, with Relocate one of them
+// is moved to another ram block of its pool (the MemoryBlock object is
+// updated, so its handle() changes). PinSetError is also thrown if the
+// set is larger than a pool.
+//
+// Blocks are pinned for writing by default, and shared blocks are then
+// copied as on lock(). With Access::Read, shared blocks stay shared.
+// --------------------------------------------------------
+class PinSetError : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+class PinSet {
+  public:
+    enum class Policy { FailFast, Relocate };
+    enum class Access { Read, Write };
+
+  private:
+    std::vector<MemoryBlock *> pinned; // by this guard
+
+    void relocate(MemoryBlock &block,
+                  const std::map<std::pair<size_t, size_t>, MemoryBlock *>
+                      &frames);
+
+  public:
+    PinSet(MemoryBlock *const *blocks, size_t count,
+           Policy policy = Policy::Relocate, Access access = Access::Write);
+    PinSet(std::initializer_list<MemoryBlock *> blocks,
+           Policy policy = Policy::Relocate, Access access = Access::Write);
+
+    PinSet(const PinSet &) = delete;
+    PinSet &operator=(const PinSet &) = delete;
+
+    ~PinSet();
+
+    // unpins blocks before the guard is destroyed
+    void release();
+};
@@ -0,0 +1,109 @@
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "stats_page.hpp"
+
+static const char STATS_MAGIC[8] = {'M', 'M', 'S', 'T', 'A', 'T', 'S', '\0'};
+
+StatsPageState ReadStatsPage(const StatsPage &page, StatsSnapshot &snapshot) {
+    if (std::memcmp(page.magic, STATS_MAGIC, sizeof(STATS_MAGIC)) != 0 ||
+        page.version != STATS_VERSION)
+        return StatsPageState::Invalid;
+
+    uint64_t words[StatsPage::NUM_WORDS];
+    for (size_t attempt = 0; attempt < STATS_READ_ATTEMPTS; ++attempt) {
+        if (attempt != 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        uint64_t before = page.sequence.load(std::memory_order_acquire);
+        if (before & 1)
+            continue; // the writer is in the middle of an update
+        for (size_t i = 0; i < StatsPage::NUM_WORDS; ++i)
+            words[i] = page.words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (page.sequence.load(std::memory_order_relaxed) == before) {
+            std::memcpy(&snapshot, words, sizeof(snapshot));
+            return StatsPageState::Valid;
+        }
+    }
+    return StatsPageState::Stale;
+}
+
+// --------------------------------------------------------
+// class StatsPublisher
+// --------------------------------------------------------
+StatsPublisher::StatsPublisher(const std::filesystem::path &file,
+                               std::chrono::milliseconds period,
+                               std::function<void(StatsSnapshot &)> collect)
+    : filepath(file), period(period), collect(std::move(collect)) {
+    int fd = open(filepath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(StatsPage)) != 0) {
+        int error = errno;
+        if (fd >= 0)
+            close(fd);
+        throw std::system_error(error, std::generic_category(),
+                                "StatsPublisher: " + filepath.string());
+    }
+    void *address = mmap(nullptr, sizeof(StatsPage), PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+    if (address == MAP_FAILED) {
+        throw std::system_error(error, std::generic_category(),
+                                "StatsPublisher: mmap()");
+    }
+
+    // the file is zero filled, magic is written last so readers never see
+    // a page without a valid sequence
+    page = static_cast<StatsPage *>(address);
+    page->version = STATS_VERSION;
+    Publish();
+    std::memcpy(page->magic, STATS_MAGIC, sizeof(STATS_MAGIC));
+
+    thread = std::thread(&StatsPublisher::Run, this);
+}
+
+void StatsPublisher::Publish() {
+    StatsSnapshot snapshot{};
+    collect(snapshot);
+    snapshot.updateTimeMs =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count();
+
+    uint64_t words[StatsPage::NUM_WORDS];
+    std::memcpy(words, &snapshot, sizeof(snapshot));
+
+    uint64_t sequence = page->sequence.load(std::memory_order_relaxed);
+    page->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < StatsPage::NUM_WORDS; ++i)
+        page->words[i].store(words[i], std::memory_order_relaxed);
+    page->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void StatsPublisher::Run() {
+    std::unique_lock<std::mutex> ul(mutex);
+    while (!stopped) {
+        condition.wait_for(ul, period, [this]() { return stopped; });
+        ul.unlock();
+        Publish();
+        ul.lock();
+    }
+}
+
+StatsPublisher::~StatsPublisher() {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stopped = true;
+    }
+    condition.notify_all();
+    thread.join();
+    munmap(page, sizeof(StatsPage));
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+//-------------------------------------------------------------------
+// Statistics published into a memory-mapped file, so they can be watched
+// by another process (memmgr_top) without any locks in the manager.
+//-------------------------------------------------------------------
+constexpr size_t STATS_MAX_POOLS = 64;
+constexpr size_t STATS_MAX_TIERS = 8;
+constexpr size_t STATS_MAX_TENANTS = 32;
+constexpr uint64_t STATS_VERSION = 3;
+// the miss ratio curve is published for these multiples of the memory limit
+constexpr size_t STATS_CURVE_POINTS = 6;
+constexpr double STATS_CURVE_FACTORS[STATS_CURVE_POINTS] = {0.25, 0.5, 1,
+                                                            2,    4,   8};
+
+// Plain copy of all published values
+struct StatsSnapshot {
+    struct Pool {
+        uint64_t blockSize;
+        uint64_t numBlocks;
+        uint64_t used;
+        uint64_t locked;
+        uint64_t swapped;
+        uint64_t swapLevels;
+        uint64_t demoted;
+    };
+    struct Tier {
+        uint64_t used;
+        uint64_t capacity; // 0 - unlimited
+    };
+    struct Tenant {
+        uint64_t id;
+        uint64_t ramBytes;
+        uint64_t reserved;
+        uint64_t limit; // 0 - unlimited
+        uint64_t swapIns;
+        uint64_t swapOuts;
+    };
+
+    uint64_t pid;
+    uint64_t memoryLimit;
+    uint64_t updateTimeMs; // since epoch
+    uint64_t numPools;
+    uint64_t numTiers;
+    Pool pools[STATS_MAX_POOLS];
+    Tier tiers[STATS_MAX_TIERS];
+    uint64_t accesses;
+    uint64_t swapIns;
+    uint64_t workingSet; // estimated bytes
+    uint64_t missRatioPpm[STATS_CURVE_POINTS]; // parts per million
+    uint64_t numTenants; // only tenants with quotas or usage are published
+    Tenant tenants[STATS_MAX_TENANTS];
+};
+
+// Layout of the file. The snapshot is stored in atomic words and guarded
+// by a sequence lock: the writer makes the sequence odd while it updates
+// the words, readers retry if it was odd or changed during their copy.
+struct StatsPage {
+    static constexpr size_t NUM_WORDS = sizeof(StatsSnapshot) / 8;
+
+    char magic[8];
+    uint64_t version;
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> words[NUM_WORDS];
+};
+
+static_assert(sizeof(StatsSnapshot) % 8 == 0, "snapshot is copied by words");
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "atomics in shared memory must be lock free");
+
+enum class StatsPageState { Valid, Invalid, Stale };
+
+// Copies a consistent snapshot from a page. Returns Invalid if it's not a
+// stats page and Stale if no consistent copy was made in
+// STATS_READ_ATTEMPTS tries, 1 ms apart: the writer has died in the
+// middle of an update.
+constexpr size_t STATS_READ_ATTEMPTS = 100;
+StatsPageState ReadStatsPage(const StatsPage &page, StatsSnapshot &snapshot);
+
+// --------------------------------------------------------
+// class StatsPublisher
+// Maps the file and writes a snapshot from `collect` every period
+// in its own thread.
+// --------------------------------------------------------
+class StatsPublisher {
+    std::filesystem::path filepath;
+    std::chrono::milliseconds period;
+    std::function<void(StatsSnapshot &)> collect;
+    StatsPage *page;
+
+    bool stopped = false;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::thread thread;
+
+    void Publish();
+    void Run();
+
+  public:
+    StatsPublisher(const std::filesystem::path &file,
+                   std::chrono::milliseconds period,
+                   std::function<void(StatsSnapshot &)> collect);
+    StatsPublisher(const StatsPublisher &) = delete;
+    StatsPublisher &operator=(const StatsPublisher &) = delete;
+    ~StatsPublisher();
+};
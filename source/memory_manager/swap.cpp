@@ -1,146 +1,465 @@
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <new>
+#include <system_error>
 #include <vector>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../utils/crc32c.hpp"
 #include "memory_pool.hpp"
 #include "swap.hpp"
 
 namespace fs = std::filesystem;
 
+//-------------------------------------------------------------------
+// class SwapSpace
+//-------------------------------------------------------------------
+SwapSpace::SwapSpace(const SwapConfig &config)
+    : config(config), prefix(config.name), tiers(config.tiers) {
+    // the first manager keeps plain names, so a single manager creates the
+    // same files as before
+    static std::atomic<size_t> numSpaces = 0;
+    size_t number = numSpaces++;
+    if (!config.persistent && number > 0)
+        prefix += std::to_string(number);
+
+    if (tiers.empty()) {
+        tiers.push_back(SwapTier{{config.dir}, 0});
+    }
+    for (SwapTier &tier : tiers) {
+        if (tier.dirs.empty())
+            tier.dirs.push_back(config.dir);
+    }
+    used = std::vector<std::atomic<size_t>>(tiers.size());
+}
+
+const SwapConfig &SwapSpace::Config() const { return config; }
+
+const std::string &SwapSpace::Prefix() const { return prefix; }
+
+size_t SwapSpace::NumTiers() const { return tiers.size(); }
+
+const SwapTier &SwapSpace::Tier(size_t tier) const { return tiers.at(tier); }
+
+bool SwapSpace::HasRoom(size_t tier, size_t bytes) const {
+    size_t capacity = tiers.at(tier).capacity;
+    return capacity == 0 || used.at(tier) + bytes <= capacity;
+}
+
+void SwapSpace::Add(size_t tier, size_t bytes) { used.at(tier) += bytes; }
+
+void SwapSpace::Remove(size_t tier, size_t bytes) { used.at(tier) -= bytes; }
+
+size_t SwapSpace::Used(size_t tier) const { return used.at(tier); }
+
 //-------------------------------------------------------------------
 // class SwapLevel
 //-------------------------------------------------------------------
 SwapLevel::SwapLevel(size_t level, size_t numBlocks, size_t blockSize)
     : level(level), numBlocks(numBlocks), blockSize(blockSize),
       totalSize(numBlocks * blockSize),
-      blockId(std::vector<SwapIdType>(numBlocks, 0)) {}
+      blockId(numBlocks), numUsed(0) {}
 
-SwapIdType &SwapLevel::at(size_t blockIndex) {
+SwapIdType SwapLevel::at(size_t blockIndex) const {
     assert(blockIndex < numBlocks);
     return blockId.at(blockIndex);
 }
 
-const SwapIdType &SwapLevel::at(size_t blockIndex) const {
+void SwapLevel::set(size_t blockIndex, SwapIdType id) {
     assert(blockIndex < numBlocks);
-    return blockId.at(blockIndex);
+    SwapIdType &oldId = blockId.at(blockIndex);
+    numUsed += (id != 0) - (oldId != 0);
+    oldId = id;
 }
 
+size_t SwapLevel::Used() const { return numUsed; }
+
+void SwapLevel::Discard(size_t) {}
+
+void SwapLevel::ReadAhead(size_t) {}
+
 SwapLevel::~SwapLevel() {}
 
 //-------------------------------------------------------------------
 // class RamSwapLevel
 //-------------------------------------------------------------------
 RamSwapLevel::RamSwapLevel(size_t level, size_t numBlocks, size_t blockSize,
-                           void *poolAddress)
+                           void *poolAddress, size_t frameSize)
     : SwapLevel(level, numBlocks, blockSize),
-      poolAddress(static_cast<char *>(poolAddress)) {}
+      poolAddress(static_cast<char *>(poolAddress)), frameSize(frameSize) {}
 
 void RamSwapLevel::WriteBlock(void *data, size_t blockIndex) {
     std::lock_guard<std::mutex> guard(mutex);
-    char *blockAddress = poolAddress + blockIndex * blockSize;
+    char *blockAddress = poolAddress + blockIndex * frameSize;
     std::memcpy(blockAddress, data, blockSize);
 }
 
 void RamSwapLevel::ReadBlock(void *data, size_t blockIndex) {
     std::lock_guard<std::mutex> guard(mutex);
-    char *blockAddress = poolAddress + blockIndex * blockSize;
+    char *blockAddress = poolAddress + blockIndex * frameSize;
     std::memcpy(data, blockAddress, blockSize);
 }
 
 RamSwapLevel::~RamSwapLevel() {}
 
+//-------------------------------------------------------------------
+// Aligned buffers for direct I/O
+//-------------------------------------------------------------------
+static size_t RoundUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static bool IsAligned(const void *data, size_t pos, size_t size) {
+    return reinterpret_cast<uintptr_t>(data) % SWAP_IO_ALIGNMENT == 0 &&
+           pos % SWAP_IO_ALIGNMENT == 0 && size % SWAP_IO_ALIGNMENT == 0;
+}
+
+AlignedBuffer::AlignedBuffer(size_t size)
+    : ptr(nullptr), length(RoundUp(std::max<size_t>(size, 1),
+                                   SWAP_IO_ALIGNMENT)) {
+    ptr = static_cast<char *>(std::aligned_alloc(SWAP_IO_ALIGNMENT, length));
+    if (!ptr)
+        throw std::bad_alloc();
+}
+
+AlignedBuffer::~AlignedBuffer() { std::free(ptr); }
+
+// Every thread which does swap I/O gets one staging buffer, it only grows
+static char *StagingBuffer(size_t size) {
+    static thread_local std::unique_ptr<AlignedBuffer> staging;
+    if (!staging || staging->size() < size)
+        staging = std::make_unique<AlignedBuffer>(size);
+    return staging->data();
+}
+
 //-------------------------------------------------------------------
 // class DiskLevel
 //-------------------------------------------------------------------
-DiskSwapLevel::DiskSwapLevel(size_t level, size_t numBlocks, size_t blockSize)
-    : SwapLevel(level, numBlocks, blockSize) {
-    fs::path swapDir = SWAP_DIR_PATH;
-    if (!fs::exists(swapDir) && !fs::create_directory(swapDir)) {
-        std::cerr << "Swap folder " << swapDir
-                  << " does not exists"
-                     " and can't create it!"
-                  << std::endl;
-        exit(1);
+static std::string LevelFileName(const std::string &prefix, size_t numBlocks,
+                                 size_t blockSize, size_t level, size_t stripe,
+                                 size_t numStripes) {
+    std::string name = prefix + "_" + std::to_string(numBlocks) +
+                       "x" + std::to_string(blockSize) + "_" + "L" +
+                       std::to_string(level);
+    if (numStripes > 1)
+        name += "_S" + std::to_string(stripe);
+    return name + ".bin";
+}
+
+DiskSwapLevel::DiskSwapLevel(size_t level, size_t numBlocks, size_t blockSize,
+                             const std::vector<fs::path> &dirs,
+                             const std::string &prefix, bool keepFiles,
+                             bool directIo, bool checksums, bool reuseExisting)
+    : SwapLevel(level, numBlocks, blockSize), keepFiles(keepFiles) {
+    if (checksums) {
+        checksum.resize(numBlocks);
+        hasChecksum.resize(numBlocks, false);
     }
+    assert(!dirs.empty());
+    const size_t numStripes = std::min(dirs.size(), numBlocks);
+    const size_t stripeSize = RoundUp(
+        (numBlocks + numStripes - 1) / numStripes * blockSize,
+        SWAP_IO_ALIGNMENT);
+
+    for (size_t i = 0; i < numStripes; ++i) {
+        fs::path swapDir = dirs.at(i);
+        if (!fs::exists(swapDir) && !fs::create_directories(swapDir)) {
+            std::cerr << "Swap folder " << swapDir
+                      << " does not exists"
+                         " and can't create it!"
+                      << std::endl;
+            exit(1);
+        }
 
-    std::string filename =
-        std::string("swap") + "_" + std::to_string(numBlocks) + "x" +
-        std::to_string(blockSize) + "_" + "L" + std::to_string(level) + ".bin";
+        stripes.push_back(std::make_unique<Stripe>());
+        Stripe &stripe = *stripes.back();
+        stripe.filepath = swapDir / LevelFileName(prefix, numBlocks, blockSize,
+                                                  level, i, numStripes);
 
-    filepath = swapDir / filename;
+        int flags = O_RDWR | O_CREAT | (reuseExisting ? 0 : O_TRUNC);
+#ifdef O_DIRECT
+        if (directIo) {
+            stripe.fd = open(stripe.filepath.c_str(), flags | O_DIRECT, 0644);
+            stripe.direct = stripe.fd >= 0;
+        }
+#endif
+        if (stripe.fd < 0)
+            stripe.fd = open(stripe.filepath.c_str(), flags, 0644);
+
+        if (stripe.fd < 0) {
+            std::cerr << "Error: Swap() can't create file " << stripe.filepath
+                      << " for writing!\n"
+                      << "Wrong rights or limit for amount of file descriptors"
+                      << std::endl;
+            exit(1);
+        }
 
-    // just to create a new file
-    std::ofstream tmp(filepath, std::ios::binary);
-    tmp.close();
+        // the file is sparse, ftruncate() doesn't allocate disk blocks
+        if (!reuseExisting && ftruncate(stripe.fd, stripeSize) != 0) {
+            std::cerr << "Error: Swap() can't resize file to " << stripeSize
+                      << " bytes!" << std::endl;
+            exit(1);
+        }
+    }
+}
 
-    try {
-        std::filesystem::resize_file(filepath, totalSize);
-    } catch (const fs::filesystem_error &) {
-        std::cerr << "Error: Swap() can't resize file to " << totalSize
-                  << " bytes!\n"
-                  << "Wrong rights or limit for amount of file descriptors"
-                  << std::endl;
-        exit(1);
+bool DiskSwapLevel::FilesExist(size_t level, size_t numBlocks,
+                               size_t blockSize,
+                               const std::vector<fs::path> &dirs,
+                               const std::string &prefix) {
+    const size_t numStripes = std::min(dirs.size(), numBlocks);
+    for (size_t i = 0; i < numStripes; ++i) {
+        if (!fs::exists(dirs.at(i) / LevelFileName(prefix, numBlocks,
+                                                   blockSize, level, i,
+                                                   numStripes)))
+            return false;
     }
+    return true;
+}
 
-    file = std::move(std::fstream(filepath, std::ios::binary | std::ios::in |
-                                                std::ios::out));
+DiskSwapLevel::Stripe &DiskSwapLevel::StripeOf(size_t blockIndex,
+                                               size_t &pos) {
+    assert(blockIndex < numBlocks);
+    pos = blockIndex / stripes.size() * blockSize;
+    return *stripes.at(blockIndex % stripes.size());
+}
+
+// Some file systems accept O_DIRECT on open but not on I/O
+bool DiskSwapLevel::DisableDirectIo(Stripe &stripe) {
+#ifdef O_DIRECT
+    if (stripe.direct) {
+        int flags = fcntl(stripe.fd, F_GETFL);
+        if (flags != -1 && fcntl(stripe.fd, F_SETFL, flags & ~O_DIRECT) == 0) {
+            stripe.direct = false;
+            return true;
+        }
+    }
+#endif
+    return false;
+}
+
+void DiskSwapLevel::ReadAt(Stripe &stripe, char *data, size_t size,
+                           size_t pos) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(stripe.fd, data + done, size - done, pos + done);
+        if (n < 0 && (errno == EINTR ||
+                      (errno == EINVAL && DisableDirectIo(stripe))))
+            continue;
+        if (n < 0) {
+            std::cerr << "Error: can't read swap file " << stripe.filepath
+                      << ": " << std::strerror(errno) << std::endl;
+            exit(1);
+        }
+        if (n == 0) {
+            // beyond the end of file (it's never written there yet)
+            std::memset(data + done, 0, size - done);
+            break;
+        }
+        done += n;
+    }
+}
 
-    if (!file) {
-        std::cerr << "Error: Swap() can't create file " << filepath
-                  << " for writing!\n"
-                  << "Wrong rights or limit for amount of file descriptors"
+void DiskSwapLevel::WriteAt(Stripe &stripe, const char *data, size_t size,
+                            size_t pos) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pwrite(stripe.fd, data + done, size - done, pos + done);
+        if (n < 0 && (errno == EINTR ||
+                      (errno == EINVAL && DisableDirectIo(stripe))))
+            continue;
+        if (n <= 0) {
+            std::cerr << "Error: can't write swap file " << stripe.filepath
+                      << ": " << std::strerror(errno) << std::endl;
+            exit(1);
+        }
+        done += n;
+    }
+}
+
+void DiskSwapLevel::VerifyChecksum(const void *data,
+                                   size_t blockIndex) const {
+    if (checksum.empty() || !hasChecksum[blockIndex])
+        return;
+    if (utils::Crc32c(data, blockSize) != checksum[blockIndex]) {
+        size_t pos = blockIndex / stripes.size() * blockSize;
+        std::cerr << "Error: checksum mismatch of block " << blockIndex
+                  << " at " << pos << " in swap file "
+                  << stripes.at(blockIndex % stripes.size())->filepath
                   << std::endl;
         exit(1);
     }
 }
 
 void DiskSwapLevel::WriteBlock(void *data, size_t blockIndex) {
-    assert(blockIndex < numBlocks);
-    std::lock_guard<std::mutex> guard(mutex);
-    size_t pos = blockIndex * blockSize;
-    file.seekp(pos);
-    file.write(reinterpret_cast<char *>(data), blockSize);
+    size_t pos = 0;
+    Stripe &stripe = StripeOf(blockIndex, pos);
+    std::lock_guard<std::mutex> guard(stripe.mutex);
+    if (!checksum.empty()) {
+        checksum[blockIndex] = utils::Crc32c(data, blockSize);
+        hasChecksum[blockIndex] = true;
+    }
+    if (!stripe.direct || IsAligned(data, pos, blockSize)) {
+        WriteAt(stripe, static_cast<char *>(data), blockSize, pos);
+        return;
+    }
+
+    // direct I/O: read-modify-write of the sectors holding the block
+    size_t first = pos / SWAP_IO_ALIGNMENT * SWAP_IO_ALIGNMENT;
+    size_t length = RoundUp(pos + blockSize, SWAP_IO_ALIGNMENT) - first;
+    char *staging = StagingBuffer(length);
+    ReadAt(stripe, staging, length, first);
+    std::memcpy(staging + (pos - first), data, blockSize);
+    WriteAt(stripe, staging, length, first);
 }
 
 void DiskSwapLevel::ReadBlock(void *data, size_t blockIndex) {
-    assert(blockIndex < numBlocks);
-    std::lock_guard<std::mutex> guard(mutex);
-    size_t pos = blockIndex * blockSize;
-    file.seekg(pos);
-    file.read(reinterpret_cast<char *>(data), blockSize);
+    size_t pos = 0;
+    Stripe &stripe = StripeOf(blockIndex, pos);
+    std::lock_guard<std::mutex> guard(stripe.mutex);
+    if (!stripe.direct || IsAligned(data, pos, blockSize)) {
+        ReadAt(stripe, static_cast<char *>(data), blockSize, pos);
+    } else {
+        size_t first = pos / SWAP_IO_ALIGNMENT * SWAP_IO_ALIGNMENT;
+        size_t length = RoundUp(pos + blockSize, SWAP_IO_ALIGNMENT) - first;
+        char *staging = StagingBuffer(length);
+        ReadAt(stripe, staging, length, first);
+        std::memcpy(data, staging + (pos - first), blockSize);
+    }
+    VerifyChecksum(data, blockIndex);
 }
 
+// The kernel reads the block in the background, a later pread() finds it in
+// the page cache. Direct I/O bypasses the cache, so there is nothing to do.
+void DiskSwapLevel::ReadAhead(size_t blockIndex) {
+#ifdef POSIX_FADV_WILLNEED
+    size_t pos = 0;
+    Stripe &stripe = StripeOf(blockIndex, pos);
+    if (!stripe.direct)
+        posix_fadvise(stripe.fd, pos, blockSize, POSIX_FADV_WILLNEED);
+#else
+    (void)blockIndex;
+#endif
+}
+
+// Only whole pages without live blocks are punched out, a page shared with
+// other blocks is released when the last of them is discarded
+void DiskSwapLevel::Discard(size_t blockIndex) {
+    if (!checksum.empty())
+        hasChecksum[blockIndex] = false;
+#ifdef FALLOC_FL_PUNCH_HOLE
+    size_t pos = 0;
+    Stripe &stripe = StripeOf(blockIndex, pos);
+    if (!stripe.punchHoles)
+        return;
+
+    const size_t numStripes = stripes.size();
+    size_t first = pos / SWAP_IO_ALIGNMENT * SWAP_IO_ALIGNMENT;
+    size_t last = RoundUp(pos + blockSize, SWAP_IO_ALIGNMENT);
+    for (size_t i = first / blockSize; i * blockSize < last; ++i) {
+        size_t index = i * numStripes + blockIndex % numStripes;
+        if (index < numBlocks && blockId.at(index) != 0)
+            return;
+    }
+
+    std::lock_guard<std::mutex> guard(stripe.mutex);
+    if (fallocate(stripe.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  first, last - first) != 0 &&
+        (errno == EOPNOTSUPP || errno == ENOSYS)) {
+        // the data is still valid, only its disk space is not given back
+        stripe.punchHoles = false;
+    }
+#else
+    (void)blockIndex;
+#endif
+}
+
+void DiskSwapLevel::RemoveFilesOnClose() { keepFiles = false; }
+
 DiskSwapLevel::~DiskSwapLevel() {
-    file.close();
-    fs::remove(filepath);
+    for (std::unique_ptr<Stripe> &stripe : stripes) {
+        close(stripe->fd);
+        if (!keepFiles)
+            fs::remove(stripe->filepath);
+    }
 }
 
 //-------------------------------------------------------------------
 // class DiskSwap
 //-------------------------------------------------------------------
 DiskSwap::DiskSwap(MemoryPool *ownerPool, void *poolAddress, size_t numBlocks,
-                   size_t blockSize)
-    : pool(ownerPool), numBlocks(numBlocks), blockSize(blockSize), numLevels(2),
-      poolAddress(static_cast<char *>(poolAddress)),
-      swapTable({new RamSwapLevel(0, numBlocks, blockSize, poolAddress),
-                 new DiskSwapLevel(1, numBlocks, blockSize)}) {
+                   size_t blockSize, size_t frameSize, SwapSpace &space)
+    : pool(ownerPool), numBlocks(numBlocks), blockSize(blockSize), numLevels(1),
+      poolAddress(static_cast<char *>(poolAddress)), frameSize(frameSize),
+      swapTable({new RamSwapLevel(0, numBlocks, blockSize, poolAddress,
+                                  frameSize)}),
+      levelTier({0}), space(space), coldSlots(space.NumTiers()),
+      tmpBlock(blockSize) {
+    // disk levels are created on the first eviction
+    if (space.Config().persistent)
+        LoadIndex();
     pool->stat.swapLevels = numLevels;
 }
 
 void DiskSwap::LoadBlockIntoRam(size_t blockIndex, SwapIdType id) {
-    if (id == swapTable.at(RAM)->at(blockIndex)) {
-        ;
-    } else {
-        size_t swapLevel = FindSwapLevel(blockIndex, id);
+    if (id == swapTable.at(RAM)->at(blockIndex))
+        return;
+
+    pool->stat.swapInCounter++;
+    size_t swapLevel = FindSwapLevel(blockIndex, id);
+    char *blockAddress = FrameAddress(blockIndex);
+    if (isRamSlotEmpty(blockIndex)) {
+        // nothing to write out (persistent swap after restart)
+        swapTable.at(swapLevel)->ReadBlock(blockAddress, blockIndex);
+        SetId(RAM, blockIndex, id);
+        SetId(swapLevel, blockIndex, 0);
+    } else if (levelTier.at(swapLevel) == 0) {
         Swap(blockIndex, swapLevel);
+    } else if (TryEvictRamBlock(blockIndex)) {
+        // the block from ram is hot, it goes to the fastest tier instead of
+        // taking the place of the loaded block in a slow one
+        swapLevel = FindSwapLevel(blockIndex, id); // it could be demoted
+        swapTable.at(swapLevel)->ReadBlock(blockAddress, blockIndex);
+        SetId(RAM, blockIndex, id);
+        SetId(swapLevel, blockIndex, 0);
+    } else {
+        // all tiers are full, the blocks just change places
+        Swap(blockIndex, FindSwapLevel(blockIndex, id));
     }
+    RetireEmptyLevels();
+}
+
+void DiskSwap::ReadBlockData(size_t blockIndex, SwapIdType id, void *data,
+                             size_t size) {
+    assert(size <= blockSize);
+    if (isBlockInRam(blockIndex, id)) {
+        std::memcpy(data, FrameAddress(blockIndex), size);
+        return;
+    }
+    size_t swapLevel = FindSwapLevel(blockIndex, id);
+    assert(swapLevel != 0);
+    swapTable.at(swapLevel)->ReadBlock(tmpBlock.data(), blockIndex);
+    std::memcpy(data, tmpBlock.data(), size);
+}
+
+void DiskSwap::ReadAhead(size_t blockIndex, SwapIdType id) {
+    if (isBlockInRam(blockIndex, id))
+        return;
+    size_t swapLevel = FindSwapLevel(blockIndex, id);
+    if (swapLevel != 0)
+        swapTable.at(swapLevel)->ReadAhead(blockIndex);
 }
 
 size_t DiskSwap::FindSwapLevel(size_t blockIndex, SwapIdType id) {
@@ -155,9 +474,15 @@ size_t DiskSwap::FindSwapLevel(size_t blockIndex, SwapIdType id) {
     return swapLevel;
 }
 
-size_t DiskSwap::FindEmptyLevel(size_t blockIndex) {
+size_t DiskSwap::FindEmptyLevel(size_t blockIndex, size_t tier) {
     // id == 0 means this level is empty and we can use it
-    return FindSwapLevel(blockIndex, 0);
+    for (size_t level = 1; level < numLevels; ++level) {
+        if (levelTier.at(level) == tier &&
+            swapTable.at(level)->at(blockIndex) == 0) {
+            return level;
+        }
+    }
+    return 0;
 }
 
 size_t DiskSwap::FindLastLevel(size_t blockIndex) {
@@ -173,23 +498,129 @@ size_t DiskSwap::FindLastLevel(size_t blockIndex) {
 }
 
 void DiskSwap::MarkBlockAllocated(size_t blockIndex, SwapIdType id) {
-    swapTable.at(RAM)->at(blockIndex) = id;
+    SetId(RAM, blockIndex, id);
 }
 
 void DiskSwap::MarkBlockFreed(size_t blockIndex, SwapIdType id) {
     size_t goalLevel = FindSwapLevel(blockIndex, id);
-    swapTable.at(goalLevel)->at(blockIndex) = 0;
+    SetId(goalLevel, blockIndex, 0);
+    RetireEmptyLevels();
+}
+
+// All changes of the swap table go through here to keep usage of
+// tiers and the order of cold blocks up to date.
+void DiskSwap::SetId(size_t level, size_t blockIndex, SwapIdType id) {
+    SwapIdType oldId = swapTable.at(level)->at(blockIndex);
+    swapTable.at(level)->set(blockIndex, id);
+    if (level == RAM)
+        return;
+
+    size_t tier = levelTier.at(level);
+    if (oldId != 0 && id == 0) {
+        space.Remove(tier, blockSize);
+        swapTable.at(level)->Discard(blockIndex);
+    } else if (oldId == 0 && id != 0) {
+        space.Add(tier, blockSize);
+    }
+
+    if (id != 0 && space.Tier(tier).capacity != 0 &&
+        tier + 1 < space.NumTiers()) {
+        std::deque<ColdSlot> &queue = coldSlots.at(tier);
+        queue.push_back(ColdSlot{level, blockIndex, id});
+
+        // drop slots which were loaded back into ram or freed
+        if (queue.size() > 2 * space.Tier(tier).capacity / blockSize + 1024) {
+            std::deque<ColdSlot> alive;
+            for (const ColdSlot &slot : queue) {
+                if (slot.level < numLevels &&
+                    swapTable.at(slot.level)->at(slot.blockIndex) == slot.id)
+                    alive.push_back(slot);
+            }
+            queue.swap(alive);
+        }
+    }
+}
+
+// Returns a level with a free slot for the block in the fastest tier
+// starting from `fromTier` which has room for it, or 0 if swap is full.
+size_t DiskSwap::PlaceBlock(size_t blockIndex, size_t fromTier) {
+    for (size_t tier = fromTier; tier < space.NumTiers(); ++tier) {
+        while (!space.HasRoom(tier, blockSize) &&
+               tier + 1 < space.NumTiers() && DemoteColdest(tier)) {
+        }
+        if (!space.HasRoom(tier, blockSize))
+            continue;
+
+        size_t level = FindEmptyLevel(blockIndex, tier);
+        if (level == 0 && numLevels < MAX_SWAP_LEVEL) {
+            // empty level not found, let's create it!
+            level = AddDiskLevel(tier);
+        }
+        if (level != 0)
+            return level;
+    }
+    return 0;
+}
+
+// Moves the block which was evicted into the tier first to a slower tier
+bool DiskSwap::DemoteColdest(size_t tier) {
+    std::deque<ColdSlot> &queue = coldSlots.at(tier);
+    while (!queue.empty()) {
+        ColdSlot slot = queue.front();
+        queue.pop_front();
+        if (slot.level >= numLevels ||
+            swapTable.at(slot.level)->at(slot.blockIndex) != slot.id)
+            continue; // it was loaded back into ram, freed or retired
+
+        size_t target = PlaceBlock(slot.blockIndex, tier + 1);
+        if (target == 0) {
+            queue.push_front(slot);
+            return false;
+        }
+        swapTable.at(slot.level)->ReadBlock(tmpBlock.data(), slot.blockIndex);
+        swapTable.at(target)->WriteBlock(tmpBlock.data(), slot.blockIndex);
+        SetId(target, slot.blockIndex, slot.id);
+        SetId(slot.level, slot.blockIndex, 0);
+        pool->stat.demotedCounter++;
+        return true;
+    }
+    return false;
+}
+
+char *DiskSwap::FrameAddress(size_t blockIndex) const {
+    return poolAddress + blockIndex * frameSize;
+}
+
+void DiskSwap::EvictRamBlock(size_t blockIndex) {
+    if (!TryEvictRamBlock(blockIndex)) {
+        std::cerr << "Error: swap is full, can't evict a block of "
+                  << blockSize << " bytes!" << std::endl;
+        throw std::bad_alloc();
+    }
+}
+
+// false if there is no room in any tier
+bool DiskSwap::TryEvictRamBlock(size_t blockIndex) {
+    size_t swapLevel = PlaceBlock(blockIndex, 0);
+    if (swapLevel == 0)
+        return false;
+    char *blockAddress = FrameAddress(blockIndex);
+    swapTable.at(swapLevel)->WriteBlock(blockAddress, blockIndex);
+    SetId(swapLevel, blockIndex, swapTable.at(RAM)->at(blockIndex));
+    SetId(RAM, blockIndex, 0);
+    return true;
 }
 
 void DiskSwap::Swap(size_t blockIndex, size_t swapLevel) {
     assert(blockIndex < numBlocks);
-    std::unique_ptr<char> tmpBlock{new char[blockSize]};
-    swapTable.at(swapLevel)->ReadBlock(tmpBlock.get(), blockIndex);
-    char *blockAddress = poolAddress + blockIndex * blockSize;
+    swapTable.at(swapLevel)->ReadBlock(tmpBlock.data(), blockIndex);
+    char *blockAddress = FrameAddress(blockIndex);
     swapTable.at(swapLevel)->WriteBlock(blockAddress, blockIndex);
-    swapTable.at(RAM)->WriteBlock(tmpBlock.get(), blockIndex);
-    std::swap(swapTable.at(RAM)->at(blockIndex),
-              swapTable.at(swapLevel)->at(blockIndex));
+    swapTable.at(RAM)->WriteBlock(tmpBlock.data(), blockIndex);
+
+    SwapIdType ramId = swapTable.at(RAM)->at(blockIndex);
+    SetId(RAM, blockIndex, swapTable.at(swapLevel)->at(blockIndex));
+    SetId(swapLevel, blockIndex, ramId);
 }
 
 bool DiskSwap::isBlockInRam(size_t blockIndex, const SwapIdType id) {
@@ -200,6 +631,17 @@ bool DiskSwap::isBlockInSwap(size_t blockIndex, SwapIdType id) {
     return id != swapTable.at(RAM)->at(blockIndex);
 }
 
+bool DiskSwap::isBlockKnown(size_t blockIndex, SwapIdType id) {
+    return id == swapTable.at(RAM)->at(blockIndex) ||
+           FindSwapLevel(blockIndex, id) != 0;
+}
+
+bool DiskSwap::isRamSlotEmpty(size_t blockIndex) {
+    return swapTable.at(RAM)->at(blockIndex) == 0;
+}
+
+bool DiskSwap::HasDiskLevels() const { return numLevels > 1; }
+
 bool DiskSwap::HasSwappedBlocks(size_t blockIndex) {
     for (size_t level = 1; level < numLevels; ++level) {
         if (swapTable.at(level)->at(blockIndex) != 0) {
@@ -209,40 +651,71 @@ bool DiskSwap::HasSwappedBlocks(size_t blockIndex) {
     return false;
 }
 
+size_t DiskSwap::CountSwappedBlocks(size_t blockIndex) {
+    size_t count = 0;
+    for (size_t level = 1; level < numLevels; ++level) {
+        if (swapTable.at(level)->at(blockIndex) != 0) {
+            ++count;
+        }
+    }
+    return count;
+}
+
 void DiskSwap::ReturnLastSwappedBlockIntoRam(size_t blockIndex) {
     size_t lastSwapLevel = FindLastLevel(blockIndex);
-    char *ramBlockAddress = poolAddress + blockIndex * blockSize;
+    char *ramBlockAddress = FrameAddress(blockIndex);
     swapTable.at(lastSwapLevel)->ReadBlock(ramBlockAddress, blockIndex);
-    swapTable.at(RAM)->at(blockIndex) =
-        swapTable.at(lastSwapLevel)->at(blockIndex);
-    swapTable.at(lastSwapLevel)->at(blockIndex) = 0; // mark freed
+    SetId(RAM, blockIndex, swapTable.at(lastSwapLevel)->at(blockIndex));
+    SetId(lastSwapLevel, blockIndex, 0); // mark freed
+    RetireEmptyLevels();
 }
 
 SwapIdType DiskSwap::Swap(size_t blockIndex) {
-    // just check if pool block is empty (no need to swap in that case)
-    if (swapTable.at(RAM) == 0) {
-        std::cout << "DiskSwap::Swap(" << blockIndex << ")."
-                  << "No need to swap: ram block with this index is empty!"
-                  << std::endl;
-        return 1; // id for ram level
+    // ram block with this index is empty (it happens after reattaching to a
+    // persistent swap), so there is nothing to write out
+    if (!isRamSlotEmpty(blockIndex)) {
+        EvictRamBlock(blockIndex); // it can demote blocks to slower tiers
+        RetireEmptyLevels();
     }
 
-    size_t swapLevel = FindEmptyLevel(blockIndex);
-    if (swapLevel == 0) {
-        // empty level not found, let's create it!
-        // but in this realisation we can have fixed amount of levels
-        assert(numLevels < MAX_SWAP_LEVEL);
+    // we are to return a new id for block in ram (after swap it has new id)
+    return FindFreeId(blockIndex);
+}
 
-        swapTable.push_back(new DiskSwapLevel{numLevels, numBlocks, blockSize});
-        swapLevel = numLevels;
-        ++numLevels;
-        pool->stat.swapLevels = numLevels;
-    }
+size_t DiskSwap::AddDiskLevel(size_t tier) {
+    // but in this realisation we can have fixed amount of levels
+    assert(numLevels < MAX_SWAP_LEVEL);
+
+    swapTable.push_back(new DiskSwapLevel{numLevels, numBlocks, blockSize,
+                                          space.Tier(tier).dirs, space.Prefix(),
+                                          space.Config().persistent,
+                                          space.Config().directIo,
+                                          space.Config().checksums});
+    levelTier.push_back(tier);
+    size_t swapLevel = numLevels;
+    ++numLevels;
+    pool->stat.swapLevels = numLevels;
+    return swapLevel;
+}
 
-    Swap(blockIndex, swapLevel);
+// Levels are numbered, so only trailing ones can be removed. One empty
+// level is kept as a spare: otherwise a block going back and forth between
+// ram and the last level would create and remove its files every time.
+void DiskSwap::RetireEmptyLevels() {
+    while (numLevels > 2 && swapTable.at(numLevels - 1)->Used() == 0 &&
+           swapTable.at(numLevels - 2)->Used() == 0) {
+        auto *level = static_cast<DiskSwapLevel *>(swapTable.back());
+        level->RemoveFilesOnClose();
+        delete level;
+        swapTable.pop_back();
+        levelTier.pop_back();
+        --numLevels;
+    }
+    pool->stat.swapLevels = numLevels;
+}
 
-    // we are to return a new id for block in ram (after swap it has new id)
-    // so, let's just find any free id in interval [2 .. MAX_SWAP_LEVEL]
+SwapIdType DiskSwap::FindFreeId(size_t blockIndex) {
+    // let's just find any free id in interval [2 .. MAX_SWAP_LEVEL]
     std::vector<char> usedIdTable(MAX_SWAP_LEVEL + 1, 0);
     for (size_t level = 0; level < numLevels; ++level) {
         SwapIdType id = swapTable.at(level)->at(blockIndex);
@@ -263,7 +736,169 @@ SwapIdType DiskSwap::Swap(size_t blockIndex) {
     return newId;
 }
 
+//-------------------------------------------------------------------
+// Persistent swap index
+//
+// Layout: magic, version, numBlocks, blockSize, numLevels and then
+// the tier and numBlocks ids of every disk level. Ram level is always
+// flushed into disk levels before the index is saved, so it's not stored.
+//-------------------------------------------------------------------
+static const char SWAP_INDEX_MAGIC[8] = {'M', 'M', 'S', 'W', 'A', 'P', 'I', 'X'};
+
+fs::path DiskSwap::IndexPath() const {
+    return space.Config().dir / (space.Prefix() + "_" +
+                                 std::to_string(numBlocks) + "x" +
+                                 std::to_string(blockSize) + ".idx");
+}
+
+bool DiskSwap::LoadIndex() {
+    const fs::path indexPath = IndexPath();
+    std::ifstream fin(indexPath, std::ios::binary);
+    if (!fin)
+        return false;
+
+    char magic[sizeof(SWAP_INDEX_MAGIC)];
+    uint32_t version = 0;
+    uint64_t storedNumBlocks = 0;
+    uint64_t storedBlockSize = 0;
+    uint32_t storedNumLevels = 0;
+    fin.read(magic, sizeof(magic));
+    fin.read(reinterpret_cast<char *>(&version), sizeof(version));
+    fin.read(reinterpret_cast<char *>(&storedNumBlocks),
+             sizeof(storedNumBlocks));
+    fin.read(reinterpret_cast<char *>(&storedBlockSize),
+             sizeof(storedBlockSize));
+    fin.read(reinterpret_cast<char *>(&storedNumLevels),
+             sizeof(storedNumLevels));
+
+    bool valid = fin && std::equal(magic, magic + sizeof(magic),
+                                   SWAP_INDEX_MAGIC) &&
+                 version == SWAP_INDEX_VERSION &&
+                 storedNumBlocks == numBlocks &&
+                 storedBlockSize == blockSize && storedNumLevels >= 1 &&
+                 storedNumLevels <= MAX_SWAP_LEVEL;
+
+    std::vector<uint32_t> tiers;
+    std::vector<std::vector<SwapIdType>> levels;
+    for (uint32_t level = 1; valid && level < storedNumLevels; ++level) {
+        uint32_t tier = 0;
+        std::vector<SwapIdType> ids(numBlocks);
+        fin.read(reinterpret_cast<char *>(&tier), sizeof(tier));
+        fin.read(reinterpret_cast<char *>(ids.data()), numBlocks);
+        valid = fin && tier < space.NumTiers() &&
+                DiskSwapLevel::FilesExist(level, numBlocks, blockSize,
+                                          space.Tier(tier).dirs,
+                                          space.Prefix());
+        tiers.push_back(tier);
+        levels.push_back(std::move(ids));
+    }
+    fin.close();
+
+    // the index describes a state which is going to change right now,
+    // so it must not be used again after a crash
+    fs::remove(indexPath);
+
+    if (!valid) {
+        std::cerr << "Persistent swap index " << indexPath
+                  << " is broken or doesn't match the pool, ignore it"
+                  << std::endl;
+        return false;
+    }
+
+    for (size_t i = 0; i < levels.size(); ++i) {
+        size_t tier = tiers.at(i);
+        swapTable.push_back(new DiskSwapLevel{numLevels, numBlocks, blockSize,
+                                              space.Tier(tier).dirs,
+                                              space.Prefix(), true,
+                                              space.Config().directIo,
+                                              space.Config().checksums, true});
+        levelTier.push_back(tier);
+        ++numLevels;
+        for (size_t blockIndex = 0; blockIndex < numBlocks; ++blockIndex) {
+            SetId(numLevels - 1, blockIndex, levels.at(i).at(blockIndex));
+        }
+    }
+    return true;
+}
+
+// ram blocks that don't fit into the swap are lost, the rest is kept
+void DiskSwap::FlushRamLevel() {
+    size_t skipped = 0;
+    for (size_t blockIndex = 0; blockIndex < numBlocks; ++blockIndex) {
+        if (!isRamSlotEmpty(blockIndex) && !TryEvictRamBlock(blockIndex))
+            ++skipped;
+    }
+    if (skipped != 0) {
+        std::cerr << "Error: swap is full, " << skipped
+                  << " ram blocks are not saved to the persistent swap"
+                  << std::endl;
+    }
+}
+
+void DiskSwap::SaveIndex() {
+    const fs::path indexPath = IndexPath();
+    fs::path tmpPath = indexPath;
+    tmpPath += ".tmp";
+
+    // with swap tiers the index folder is not created by the swap files
+    std::error_code error;
+    fs::create_directories(indexPath.parent_path(), error);
+    std::ofstream fout(tmpPath, std::ios::binary);
+    uint32_t version = SWAP_INDEX_VERSION;
+    uint64_t storedNumBlocks = numBlocks;
+    uint64_t storedBlockSize = blockSize;
+    uint32_t storedNumLevels = numLevels;
+    fout.write(SWAP_INDEX_MAGIC, sizeof(SWAP_INDEX_MAGIC));
+    fout.write(reinterpret_cast<char *>(&version), sizeof(version));
+    fout.write(reinterpret_cast<char *>(&storedNumBlocks),
+               sizeof(storedNumBlocks));
+    fout.write(reinterpret_cast<char *>(&storedBlockSize),
+               sizeof(storedBlockSize));
+    fout.write(reinterpret_cast<char *>(&storedNumLevels),
+               sizeof(storedNumLevels));
+    for (size_t level = 1; level < numLevels; ++level) {
+        uint32_t tier = levelTier.at(level);
+        fout.write(reinterpret_cast<char *>(&tier), sizeof(tier));
+        for (size_t blockIndex = 0; blockIndex < numBlocks; ++blockIndex) {
+            SwapIdType id = swapTable.at(level)->at(blockIndex);
+            fout.write(reinterpret_cast<char *>(&id), sizeof(id));
+        }
+    }
+    fout.close();
+
+    if (!fout) {
+        std::cerr << "Error: can't save persistent swap index " << indexPath
+                  << std::endl;
+        return;
+    }
+    // rename is atomic, so the index is either old or completely new
+    fs::rename(tmpPath, indexPath, error);
+    if (error) {
+        std::cerr << "Error: can't save persistent swap index " << indexPath
+                  << ": " << error.message() << std::endl;
+    }
+}
+
 DiskSwap::~DiskSwap() {
+    // the index is written even if some ram blocks can't be flushed,
+    // nothing is thrown from here
+    if (space.Config().persistent) {
+        try {
+            FlushRamLevel();
+        } catch (const std::exception &e) {
+            std::cerr << "Error: can't flush ram blocks to the persistent "
+                         "swap: "
+                      << e.what() << std::endl;
+        }
+        SaveIndex();
+    }
+    // files are removed or kept as a whole, so blocks are not discarded
+    for (size_t level = 1; level < numLevels; ++level) {
+        for (size_t blockIndex = 0; blockIndex < numBlocks; ++blockIndex) {
+            if (swapTable.at(level)->at(blockIndex) != 0)
+                space.Remove(levelTier.at(level), blockSize);
+        }
+    }
     for (SwapLevel *swapLevel : swapTable) {
         delete swapLevel;
     }
@@ -1,13 +1,18 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <filesystem>
-#include <fstream>
 #include <limits>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
+#include "../utils/zeroed_allocator.hpp"
+
 //-------------------------------------------
 // swap config
 //-------------------------------------------
@@ -15,35 +20,124 @@ static const std::string SWAP_DIR_PATH = "swap";
 
 using SwapIdType = uint8_t;
 constexpr SwapIdType MAX_SWAP_LEVEL = std::numeric_limits<SwapIdType>::max();
+
+// One tier of swap storage. Level files of a tier are striped between its
+// directories (e.g. one directory per device), so they are used in
+// parallel. Capacity is a limit in bytes, 0 means unlimited. When every
+// tier is full, an allocation which has to evict a block throws
+// std::bad_alloc.
+struct SwapTier {
+    std::vector<std::filesystem::path> dirs;
+    size_t capacity = 0;
+};
+
+// Tiers are ordered from the fastest to the slowest one. Freshly evicted
+// blocks go to the fastest tier with free space, and when it's full its
+// coldest blocks are demoted to slower tiers. Without tiers the whole swap
+// is in `dir`.
+//
+// Swap files are named after `name`. Several managers (arenas) can share
+// a directory: non-persistent ones get a unique suffix automatically,
+// persistent ones must have different names to find their files again.
+//
+// In persistent mode swap files are kept on exit together with an index
+// of live blocks (it's stored in `dir`), so the next run can reattach to
+// them (see MemoryManager::attach). The index is versioned and is ignored
+// if it doesn't match the current pool geometry.
+struct SwapConfig {
+    std::filesystem::path dir = SWAP_DIR_PATH;
+    std::vector<SwapTier> tiers;
+    std::string name = "swap";
+    bool persistent = false;
+    // Open swap files with O_DIRECT, so swapped data doesn't take place in
+    // the kernel page cache. Every swap then waits for the device, so it's
+    // off by default. It falls back to buffered I/O where O_DIRECT is not
+    // supported (e.g. tmpfs).
+    bool directIo = false;
+    // Keep a CRC32C of every block written to swap files and check it when
+    // the block is read back, a mismatch stops the program. It takes 4
+    // bytes of RAM per block in swap. Checksums are not saved in the index
+    // of a persistent swap, blocks restored from it are not checked.
+    bool checksums = false;
+};
+
+constexpr uint32_t SWAP_INDEX_VERSION = 2;
+
+// Alignment of buffers, offsets and sizes for direct I/O (a sector size)
+constexpr size_t SWAP_IO_ALIGNMENT = 4096;
 //-------------------------------------------
 
+// Memory aligned to SWAP_IO_ALIGNMENT, its size is rounded up to it
+class AlignedBuffer {
+    char *ptr;
+    size_t length;
+
+  public:
+    explicit AlignedBuffer(size_t size);
+    AlignedBuffer(const AlignedBuffer &) = delete;
+    AlignedBuffer &operator=(const AlignedBuffer &) = delete;
+    ~AlignedBuffer();
+
+    char *data() const { return ptr; }
+    size_t size() const { return length; }
+};
+
+// Swap storage shared by all pools of a manager
+class SwapSpace {
+    SwapConfig config;
+    std::string prefix;
+    std::vector<SwapTier> tiers;
+    std::vector<std::atomic<size_t>> used;
+
+  public:
+    explicit SwapSpace(const SwapConfig &config);
+
+    const SwapConfig &Config() const;
+    const std::string &Prefix() const; // of swap file names
+    size_t NumTiers() const;
+    const SwapTier &Tier(size_t tier) const;
+
+    bool HasRoom(size_t tier, size_t bytes) const;
+    void Add(size_t tier, size_t bytes);
+    void Remove(size_t tier, size_t bytes);
+    size_t Used(size_t tier) const;
+};
+
 class SwapLevel {
   protected:
     size_t level;
     size_t numBlocks;
     size_t blockSize;
     size_t totalSize;
-    std::vector<SwapIdType> blockId;
+    utils::ZeroedVector<SwapIdType> blockId;
+    size_t numUsed; // blocks with id != 0
 
   public:
     SwapLevel(size_t level, size_t numBlocks, size_t blockSize);
 
-    SwapIdType &at(size_t blockIndex);
-    const SwapIdType &at(size_t blockIndex) const;
+    SwapIdType at(size_t blockIndex) const;
+    void set(size_t blockIndex, SwapIdType id);
+    size_t Used() const;
 
     virtual void WriteBlock(void *data, size_t blockIndex) = 0;
     virtual void ReadBlock(void *data, size_t blockIndex) = 0;
+    // The block was freed or moved away, its data is not needed anymore
+    virtual void Discard(size_t blockIndex);
+    // The block will be read soon, a hint which doesn't wait for I/O
+    virtual void ReadAhead(size_t blockIndex);
 
     virtual ~SwapLevel();
 };
 
+// Frames of the pool, `frameSize` bytes apart (a block can be padded)
 class RamSwapLevel : public SwapLevel {
     char *poolAddress;
+    size_t frameSize;
     std::mutex mutex;
 
   public:
     RamSwapLevel(size_t level, size_t numBlocks, size_t blockSize,
-                 void *poolAddress);
+                 void *poolAddress, size_t frameSize);
 
     void WriteBlock(void *data, size_t blockIndex) override;
     void ReadBlock(void *data, size_t blockIndex) override;
@@ -51,16 +145,54 @@ class RamSwapLevel : public SwapLevel {
     ~RamSwapLevel() override;
 };
 
+// Blocks are read and written with pread/pwrite. Blocks which are not
+// aligned for direct I/O (small ones, or unaligned buffers) go through a
+// per-thread staging buffer: the sector holding the block is read, and
+// for writes patched and written back.
+//
+// Files are sparse: disk space is taken by written blocks only, and the
+// pages of discarded blocks are given back to the file system by punching
+// holes in the files.
 class DiskSwapLevel : public SwapLevel {
-    std::filesystem::path filepath;
-    std::fstream file;
-    std::mutex mutex;
+    // block i is stored in stripe (i % stripes) at position (i / stripes)
+    struct Stripe {
+        std::filesystem::path filepath;
+        int fd = -1;
+        bool direct = false;
+        bool punchHoles = true; // off if the file system can't do it
+        std::mutex mutex;
+    };
+    std::vector<std::unique_ptr<Stripe>> stripes;
+    bool keepFiles;
+    // CRC32C of written blocks, empty if checksums are off
+    std::vector<uint32_t> checksum;
+    std::vector<bool> hasChecksum;
+
+    void VerifyChecksum(const void *data, size_t blockIndex) const;
+
+    Stripe &StripeOf(size_t blockIndex, size_t &pos);
+    static void ReadAt(Stripe &stripe, char *data, size_t size, size_t pos);
+    static void WriteAt(Stripe &stripe, const char *data, size_t size,
+                        size_t pos);
+    static bool DisableDirectIo(Stripe &stripe);
 
   public:
-    DiskSwapLevel(size_t level, size_t numBlocks, size_t blockSize);
+    DiskSwapLevel(size_t level, size_t numBlocks, size_t blockSize,
+                  const std::vector<std::filesystem::path> &dirs,
+                  const std::string &prefix, bool keepFiles, bool directIo,
+                  bool checksums, bool reuseExisting = false);
+
+    static bool FilesExist(size_t level, size_t numBlocks, size_t blockSize,
+                           const std::vector<std::filesystem::path> &dirs,
+                           const std::string &prefix);
 
     void WriteBlock(void *data, size_t blockIndex) override;
     void ReadBlock(void *data, size_t blockIndex) override;
+    void Discard(size_t blockIndex) override;
+    void ReadAhead(size_t blockIndex) override;
+
+    // files are removed on close even if they were to be kept
+    void RemoveFilesOnClose();
 
     ~DiskSwapLevel() override;
 };
@@ -68,31 +200,68 @@ class DiskSwapLevel : public SwapLevel {
 class MemoryPool;
 
 class DiskSwap {
+    // a block in a swap tier with limited capacity, in order of eviction
+    struct ColdSlot {
+        size_t level;
+        size_t blockIndex;
+        SwapIdType id;
+    };
+
     MemoryPool *pool;
     size_t numBlocks;
     size_t blockSize;
     SwapIdType numLevels;
     char *poolAddress;
+    size_t frameSize; // distance between ram blocks
     std::vector<SwapLevel *> swapTable;
+    std::vector<size_t> levelTier;
+    SwapSpace &space;
+    std::vector<std::deque<ColdSlot>> coldSlots; // for each tier
+    AlignedBuffer tmpBlock;
 
     const size_t RAM = 0;
 
-    size_t FindEmptyLevel(size_t blockIndex);
+    size_t FindEmptyLevel(size_t blockIndex, size_t tier);
     size_t FindLastLevel(size_t blockIndex);
     size_t FindSwapLevel(size_t blockIndex, SwapIdType id);
+    SwapIdType FindFreeId(size_t blockIndex);
+    size_t AddDiskLevel(size_t tier);
+    void RetireEmptyLevels();
+
+    void SetId(size_t level, size_t blockIndex, SwapIdType id);
+    size_t PlaceBlock(size_t blockIndex, size_t fromTier);
+    bool DemoteColdest(size_t tier);
+    void EvictRamBlock(size_t blockIndex);
+    bool TryEvictRamBlock(size_t blockIndex);
+    char *FrameAddress(size_t blockIndex) const;
+
+    std::filesystem::path IndexPath() const;
+    bool LoadIndex();
+    void SaveIndex();
+    void FlushRamLevel();
 
   public:
     DiskSwap(MemoryPool *ownerPool, void *poolAddress, size_t numBlocks,
-             size_t blockSize);
+             size_t blockSize, size_t frameSize, SwapSpace &space);
 
     void MarkBlockAllocated(size_t blockIndex, SwapIdType id);
     void MarkBlockFreed(size_t blockIndex, SwapIdType id);
 
     bool isBlockInRam(size_t blockIndex, SwapIdType id);
     bool isBlockInSwap(size_t blockIndex, SwapIdType id);
+    bool isBlockKnown(size_t blockIndex, SwapIdType id);
+    bool isRamSlotEmpty(size_t blockIndex);
 
     void LoadBlockIntoRam(size_t blockIndex, SwapIdType id);
+    // Copies first `size` bytes of a block wherever it is, a swapped out
+    // block is not loaded into ram
+    void ReadBlockData(size_t blockIndex, SwapIdType id, void *data,
+                       size_t size);
+    // Starts reading a swapped out block into the page cache
+    void ReadAhead(size_t blockIndex, SwapIdType id);
+    bool HasDiskLevels() const;
     bool HasSwappedBlocks(size_t blockIndex);
+    size_t CountSwappedBlocks(size_t blockIndex);
     void ReturnLastSwappedBlockIntoRam(size_t blockIndex);
 
     void Swap(size_t blockIndex, size_t swapLevel);
@@ -0,0 +1,400 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "memory_manager.hpp"
+#include "pin_set.hpp"
+
+// --------------------------------------------------------
+// class SwappableVector
+//
+// A growing array of trivially copyable elements stored in pages of the
+// largest block size of a manager, so it can be much larger than RAM.
+// Elements are accessed by value (get/set or random access iterators) or
+// in place through a sequential cursor which pins one page at a time and
+// asks for the next one to be read ahead from swap. append() and copy()
+// move data a page at a time. It's not thread safe, like std::vector.
+// --------------------------------------------------------
+template <typename T> class SwappableVector {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "SwappableVector stores elements as raw bytes");
+
+    MemoryManager *manager;
+    size_t perPage;
+    size_t count = 0;
+    std::vector<MemoryBlock> pages;
+    // Pages pinned by live cursors. Other pages can share a ram block with
+    // them, and locking such a page would wait for the cursor forever.
+    std::vector<MemoryBlock *> pinned;
+
+    void addPage() {
+        pages.push_back(manager->getBlock(perPage * sizeof(T)));
+    }
+
+    // A page which can be locked while cursors are alive: if it shares a
+    // ram block with a pinned page, it's moved to another one first (see
+    // PinSet::Policy::Relocate). The page keeps its data.
+    MemoryBlock &page(size_t pageIndex) const {
+        MemoryBlock &target = const_cast<MemoryBlock &>(pages[pageIndex]);
+        for (MemoryBlock *other : pinned) {
+            if (other != &target &&
+                other->handle().blockIndex == target.handle().blockIndex) {
+                PinSet relocate({other, &target}, PinSet::Policy::Relocate,
+                                PinSet::Access::Read);
+                break;
+            }
+        }
+        return target;
+    }
+
+    void freePages() {
+        for (MemoryBlock &page : pages)
+            page.free();
+        pages.clear();
+        count = 0;
+    }
+
+  public:
+    class Reference;
+    template <bool Const> class Iterator;
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+    class Cursor;
+
+    explicit SwappableVector(MemoryManager &manager = memoryManager)
+        : manager(&manager), perPage(manager.maxBlockSize() / sizeof(T)) {
+        assert(perPage > 0 && "element is larger than the largest block");
+    }
+
+    SwappableVector(const SwappableVector &) = delete;
+    SwappableVector &operator=(const SwappableVector &) = delete;
+
+    SwappableVector(SwappableVector &&other)
+        : manager(other.manager), perPage(other.perPage), count(other.count),
+          pages(std::move(other.pages)) {
+        other.count = 0;
+    }
+
+    SwappableVector &operator=(SwappableVector &&other) {
+        freePages();
+        manager = other.manager;
+        perPage = other.perPage;
+        count = other.count;
+        pages = std::move(other.pages);
+        other.count = 0;
+        return *this;
+    }
+
+    ~SwappableVector() { freePages(); }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t elementsPerPage() const { return perPage; }
+    void clear() { freePages(); }
+
+    T get(size_t index) const {
+        assert(index < count);
+        const MemoryBlock &block = page(index / perPage);
+        return static_cast<const T *>(block.data<const T>())[index % perPage];
+    }
+
+    T at(size_t index) const {
+        if (index >= count)
+            throw std::out_of_range("SwappableVector::at()");
+        return get(index);
+    }
+
+    void set(size_t index, const T &value) {
+        assert(index < count);
+        MemoryBlock &block = page(index / perPage);
+        static_cast<T *>(block.data<T>())[index % perPage] = value;
+    }
+
+    void push_back(const T &value) { append(&value, 1); }
+
+    // Appends `n` elements, every touched page is locked only once
+    void append(const T *data, size_t n) {
+        while (n > 0) {
+            size_t offset = count % perPage;
+            if (offset == 0)
+                addPage();
+            size_t chunk = std::min(n, perPage - offset);
+            MemoryBlock &block = page(pages.size() - 1);
+            std::memcpy(static_cast<T *>(block.data<T>()) + offset, data,
+                        chunk * sizeof(T));
+            data += chunk;
+            count += chunk;
+            n -= chunk;
+        }
+    }
+
+    void append(const SwappableVector &other) {
+        std::vector<T> buffer(other.perPage);
+        for (size_t first = 0; first < other.size(); first += other.perPage) {
+            size_t n = std::min(other.perPage, other.size() - first);
+            other.copy(first, n, buffer.data());
+            append(buffer.data(), n);
+        }
+    }
+
+    // Copies elements [first, first + n) into `out`
+    void copy(size_t first, size_t n, T *out) const {
+        assert(first + n <= count);
+        while (n > 0) {
+            const MemoryBlock &block = page(first / perPage);
+            size_t offset = first % perPage;
+            size_t chunk = std::min(n, perPage - offset);
+            std::memcpy(out,
+                        static_cast<const T *>(block.data<const T>()) + offset,
+                        chunk * sizeof(T));
+            out += chunk;
+            first += chunk;
+            n -= chunk;
+        }
+    }
+
+    // Overwrites elements [first, first + n) with `data`
+    void write(size_t first, const T *data, size_t n) {
+        assert(first + n <= count);
+        while (n > 0) {
+            MemoryBlock &block = page(first / perPage);
+            size_t offset = first % perPage;
+            size_t chunk = std::min(n, perPage - offset);
+            std::memcpy(static_cast<T *>(block.data<T>()) + offset, data,
+                        chunk * sizeof(T));
+            data += chunk;
+            first += chunk;
+            n -= chunk;
+        }
+    }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, count); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, count); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    // Sequential access in place: for (T &x : v.sequential()) {...}
+    struct SequentialRange {
+        SwappableVector *vector;
+        size_t first;
+        Cursor begin() const { return Cursor(vector, first); }
+        size_t end() const { return vector->count; }
+    };
+
+    SequentialRange sequential(size_t first = 0) {
+        return SequentialRange{this, first};
+    }
+
+    // --------------------------------------------------------
+    // Element of a mutable iterator: it's read with get() when converted
+    // to T and written with set() when assigned, like std::vector<bool>
+    // references.
+    // --------------------------------------------------------
+    class Reference {
+        SwappableVector *vector;
+        size_t index;
+
+      public:
+        Reference(SwappableVector *vector, size_t index)
+            : vector(vector), index(index) {}
+
+        operator T() const { return vector->get(index); }
+        Reference &operator=(const T &value) {
+            vector->set(index, value);
+            return *this;
+        }
+        Reference &operator=(const Reference &other) {
+            return *this = static_cast<T>(other);
+        }
+        friend void swap(Reference a, Reference b) {
+            T value = a;
+            a = static_cast<T>(b);
+            b = value;
+        }
+    };
+
+    // --------------------------------------------------------
+    // Random access iterators: const_iterator returns elements by value,
+    // iterator returns a Reference. A page is locked on every access, the
+    // cursor is faster for sequential passes.
+    // --------------------------------------------------------
+    template <bool Const> class Iterator {
+        friend class Iterator<!Const>;
+        using Vector =
+            std::conditional_t<Const, const SwappableVector, SwappableVector>;
+
+        Vector *vector = nullptr;
+        size_t index = 0;
+
+      public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = std::conditional_t<Const, T, Reference>;
+
+        Iterator() = default;
+        Iterator(Vector *vector, size_t index)
+            : vector(vector), index(index) {}
+        // iterator converts to const_iterator
+        template <bool C = Const, typename = std::enable_if_t<C>>
+        Iterator(const Iterator<false> &other)
+            : vector(other.vector), index(other.index) {}
+
+        reference operator*() const {
+            if constexpr (Const)
+                return vector->get(index);
+            else
+                return Reference(vector, index);
+        }
+        reference operator[](difference_type n) const { return *(*this + n); }
+
+        Iterator &operator++() {
+            ++index;
+            return *this;
+        }
+        Iterator operator++(int) {
+            Iterator old = *this;
+            ++index;
+            return old;
+        }
+        Iterator &operator--() {
+            --index;
+            return *this;
+        }
+        Iterator operator--(int) {
+            Iterator old = *this;
+            --index;
+            return old;
+        }
+        Iterator &operator+=(difference_type n) {
+            index += n;
+            return *this;
+        }
+        Iterator &operator-=(difference_type n) {
+            index -= n;
+            return *this;
+        }
+        Iterator operator+(difference_type n) const {
+            return Iterator(vector, index + n);
+        }
+        friend Iterator operator+(difference_type n, const Iterator &it) {
+            return it + n;
+        }
+        Iterator operator-(difference_type n) const {
+            return Iterator(vector, index - n);
+        }
+        difference_type operator-(const Iterator &other) const {
+            return static_cast<difference_type>(index) -
+                   static_cast<difference_type>(other.index);
+        }
+
+        bool operator==(const Iterator &other) const {
+            return index == other.index;
+        }
+        bool operator!=(const Iterator &other) const {
+            return index != other.index;
+        }
+        bool operator<(const Iterator &other) const {
+            return index < other.index;
+        }
+        bool operator>(const Iterator &other) const {
+            return index > other.index;
+        }
+        bool operator<=(const Iterator &other) const {
+            return index <= other.index;
+        }
+        bool operator>=(const Iterator &other) const {
+            return index >= other.index;
+        }
+    };
+
+    // --------------------------------------------------------
+    // Sequential cursor: keeps the current page locked, so elements can be
+    // read and written in place. When it enters a page, the next one is
+    // read ahead from swap in the background (MemoryBlock::readAhead()), so
+    // the disk works while the current page is processed. It's move only
+    // and compares equal to the end index. Other elements can be accessed
+    // while a cursor is alive, a page which shares a ram block with the
+    // pinned one is moved to another ram block then.
+    // --------------------------------------------------------
+    class Cursor {
+        SwappableVector *vector;
+        size_t index;
+        MemoryBlock *page = nullptr;
+        T *data = nullptr;
+        bool owned = false; // the page is pinned by this cursor
+
+        void enterPage() {
+            if (index >= vector->count)
+                return;
+            size_t pageIndex = index / vector->perPage;
+            page = &vector->page(pageIndex);
+            // another cursor can be on this page already
+            owned = !page->isLocked();
+            if (owned) {
+                page->lock();
+                vector->pinned.push_back(page);
+            }
+            data = static_cast<T *>(page->data<T>());
+            if (pageIndex + 1 < vector->pages.size())
+                vector->pages[pageIndex + 1].readAhead();
+        }
+
+        void leavePage() {
+            if (page && owned) {
+                auto &pinned = vector->pinned;
+                pinned.erase(std::find(pinned.begin(), pinned.end(), page));
+                page->unlock();
+            }
+            page = nullptr;
+            data = nullptr;
+            owned = false;
+        }
+
+      public:
+        Cursor(SwappableVector *vector, size_t index)
+            : vector(vector), index(index) {
+            enterPage();
+        }
+
+        Cursor(const Cursor &) = delete;
+        Cursor &operator=(const Cursor &) = delete;
+
+        Cursor(Cursor &&other)
+            : vector(other.vector), index(other.index), page(other.page),
+              data(other.data), owned(other.owned) {
+            other.page = nullptr;
+            other.owned = false;
+        }
+
+        ~Cursor() { leavePage(); }
+
+        T &operator*() const { return data[index % vector->perPage]; }
+        T *operator->() const { return &**this; }
+
+        Cursor &operator++() {
+            ++index;
+            if (index % vector->perPage == 0) {
+                leavePage();
+                enterPage();
+            }
+            return *this;
+        }
+
+        size_t position() const { return index; }
+
+        bool operator==(size_t end) const { return index == end; }
+        bool operator!=(size_t end) const { return index != end; }
+    };
+};
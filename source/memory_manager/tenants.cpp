@@ -0,0 +1,69 @@
+#include <stdexcept>
+#include <string>
+
+#include "tenants.hpp"
+
+static thread_local size_t currentTenant = 0;
+
+size_t CurrentTenant() { return currentTenant; }
+
+// --------------------------------------------------------
+// class TenantScope
+// --------------------------------------------------------
+TenantScope::TenantScope(size_t tenant) : previous(currentTenant) {
+    if (tenant >= MAX_TENANTS) {
+        throw std::invalid_argument("TenantScope: tenant must be less than " +
+                                    std::to_string(MAX_TENANTS));
+    }
+    currentTenant = tenant;
+}
+
+TenantScope::~TenantScope() { currentTenant = previous; }
+
+// --------------------------------------------------------
+// class TenantTable
+// --------------------------------------------------------
+void TenantTable::SetQuota(size_t tenant, size_t reserved, size_t limit) {
+    if (tenant >= MAX_TENANTS || reserved > limit) {
+        throw std::invalid_argument("TenantTable::SetQuota(): bad quota of "
+                                    "tenant " +
+                                    std::to_string(tenant));
+    }
+    tenants[tenant].reserved = reserved;
+    tenants[tenant].limit = limit;
+    hasQuotas = true;
+}
+
+bool TenantTable::HasQuotas() const { return hasQuotas; }
+
+void TenantTable::Charge(size_t from, size_t to, size_t bytes) {
+    if (from == to)
+        return;
+    if (from != NO_TENANT)
+        tenants[from].ramBytes -= bytes;
+    if (to != NO_TENANT)
+        tenants[to].ramBytes += bytes;
+}
+
+void TenantTable::CountSwapIn(size_t tenant) { tenants[tenant].swapIns++; }
+
+void TenantTable::CountSwapOut(size_t tenant) {
+    if (tenant != NO_TENANT)
+        tenants[tenant].swapOuts++;
+}
+
+int TenantTable::EvictionRank(size_t owner, size_t requester) const {
+    if (owner == NO_TENANT)
+        return 0;
+    const TenantStat &stat = tenants[owner];
+    size_t usage = stat.ramBytes;
+    if (usage > stat.limit)
+        return owner == requester ? 0 : 1;
+    if (usage > stat.reserved)
+        return 2;
+    return RESERVED_RANK;
+}
+
+const TenantStat &TenantTable::Stat(size_t tenant) const {
+    return tenants.at(tenant);
+}
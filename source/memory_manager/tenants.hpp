@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+//-------------------------------------------------------------------
+// Tenants share the RAM of a manager: every block belongs to the tenant
+// of the thread which allocated it (0 by default, see TenantScope). A
+// tenant can get a reservation - RAM which is not taken by other tenants
+// while the tenant uses no more than that, and a limit - above it the
+// tenant's own blocks are evicted first.
+//-------------------------------------------------------------------
+constexpr size_t TENANT_BITS = 5;
+constexpr size_t MAX_TENANTS = size_t(1) << TENANT_BITS;
+constexpr size_t NO_TENANT = MAX_TENANTS; // of an empty ram block
+
+// Blocks allocated by the thread while the scope is alive belong to the
+// tenant. Scopes can be nested.
+class TenantScope {
+    size_t previous;
+
+  public:
+    explicit TenantScope(size_t tenant); // throws std::invalid_argument
+    TenantScope(const TenantScope &) = delete;
+    TenantScope &operator=(const TenantScope &) = delete;
+    ~TenantScope();
+};
+
+size_t CurrentTenant();
+
+struct TenantStat {
+    std::atomic<size_t> ramBytes = 0;
+    std::atomic<size_t> swapIns = 0;
+    std::atomic<size_t> swapOuts = 0;
+    std::atomic<size_t> reserved = 0;
+    std::atomic<size_t> limit = SIZE_MAX;
+};
+
+// Quotas and usage of tenants, shared by all pools of a manager
+class TenantTable {
+    std::array<TenantStat, MAX_TENANTS> tenants;
+    std::atomic<bool> hasQuotas = false;
+
+  public:
+    void SetQuota(size_t tenant, size_t reserved, size_t limit);
+    bool HasQuotas() const;
+
+    // moves bytes of a ram block from one tenant to another, any of them
+    // can be NO_TENANT
+    void Charge(size_t from, size_t to, size_t bytes);
+    void CountSwapIn(size_t tenant);
+    void CountSwapOut(size_t tenant);
+
+    // Eviction order of ram blocks, lower goes first: blocks of the
+    // `requester` itself when it's over its limit, then of tenants over
+    // their limits, then above their reservations, then the rest.
+    int EvictionRank(size_t owner, size_t requester) const;
+    // rank of blocks of tenants within their reservations
+    static const int RESERVED_RANK = 3;
+
+    const TenantStat &Stat(size_t tenant) const;
+};
@@ -0,0 +1,123 @@
+#include <atomic>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include "thread_partitions.hpp"
+
+// a smaller partition has only a few frames in its pools, so blocks of one
+// thread would keep replacing each other
+static const size_t MIN_PARTITION_SIZE = 64 * 1024;
+
+// the partition of the calling thread found last time
+struct PartitionCache {
+    uint64_t serial = 0;
+    MemoryManager *partition = nullptr;
+};
+static thread_local PartitionCache cache;
+
+static uint64_t NextSerial() {
+    static std::atomic<uint64_t> serial = 0;
+    return ++serial;
+}
+
+// Instances by serial, so that exiting threads don't touch destroyed ones
+static std::mutex instancesMutex;
+static std::map<uint64_t, ThreadPartitions *> instances;
+
+// Gives the partitions of a thread back when it exits
+struct ThreadExit {
+    std::vector<uint64_t> serials;
+
+    ~ThreadExit() {
+        std::lock_guard<std::mutex> guard(instancesMutex);
+        for (uint64_t serial : serials) {
+            auto it = instances.find(serial);
+            if (it != instances.end())
+                it->second->releaseThread(std::this_thread::get_id());
+        }
+    }
+};
+static thread_local ThreadExit threadExit;
+
+// --------------------------------------------------------
+// class ThreadPartitions
+// --------------------------------------------------------
+ThreadPartitions::ThreadPartitions(size_t memoryLimit, size_t maxThreads,
+                                   const SwapConfig &config)
+    : partitionSize(maxThreads != 0 ? memoryLimit / maxThreads : 0),
+      maxPartitions(maxThreads), config(config), serial(NextSerial()) {
+    if (partitionSize < MIN_PARTITION_SIZE) {
+        throw std::invalid_argument(
+            "ThreadPartitions: " + std::to_string(memoryLimit) +
+            " bytes are too few for " + std::to_string(maxThreads) +
+            " threads");
+    }
+    std::lock_guard<std::mutex> guard(instancesMutex);
+    instances[serial] = this;
+}
+
+ThreadPartitions::~ThreadPartitions() {
+    std::lock_guard<std::mutex> guard(instancesMutex);
+    instances.erase(serial);
+}
+
+MemoryManager &ThreadPartitions::local() {
+    if (cache.serial == serial)
+        return *cache.partition;
+    return registerThread();
+}
+
+MemoryManager &ThreadPartitions::registerThread() {
+    std::lock_guard<std::mutex> guard(mutex);
+    MemoryManager *&partition = byThread[std::this_thread::get_id()];
+    if (!partition) {
+        if (!released.empty()) {
+            partition = released.back();
+            released.pop_back();
+        } else if (partitions.size() == maxPartitions) {
+            byThread.erase(std::this_thread::get_id());
+            std::cerr << "ThreadPartitions: all " << maxPartitions
+                      << " partitions are taken" << std::endl;
+            throw std::bad_alloc();
+        } else {
+            SwapConfig partitionConfig = config;
+            partitionConfig.name += "_t" + std::to_string(partitions.size());
+            try {
+                partitions.push_back(std::make_unique<MemoryManager>(
+                    partitionSize, partitionConfig));
+            } catch (...) {
+                byThread.erase(std::this_thread::get_id());
+                throw;
+            }
+            partition = partitions.back().get();
+        }
+        threadExit.serials.push_back(serial);
+    }
+    cache.serial = serial;
+    cache.partition = partition;
+    return *partition;
+}
+
+void ThreadPartitions::releaseThread(std::thread::id thread) {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = byThread.find(thread);
+    if (it == byThread.end())
+        return;
+    released.push_back(it->second);
+    byThread.erase(it);
+}
+
+size_t ThreadPartitions::numPartitions() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return partitions.size();
+}
+
+void ThreadPartitions::printStatistics() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    for (size_t i = 0; i < partitions.size(); ++i) {
+        std::cout << "Partition " << i << ":" << std::endl;
+        partitions[i]->printStatistics();
+    }
+}
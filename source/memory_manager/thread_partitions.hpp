@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "memory_manager.hpp"
+
+// --------------------------------------------------------
+// class ThreadPartitions
+//
+// RAM split between threads: a thread gets its own partition - a manager
+// with private frames of every pool and its own swap files - on its first
+// call of local(). Carving a partition is the only operation which takes
+// a shared lock, after that the thread finds it through a thread local
+// cache, and its swap-ins and evictions never touch frames or swap of
+// other threads.
+//
+// Any pair of a thread's blocks can be held at once with PinSet (Relocate
+// policy): if the blocks share a frame, one of them moves to another frame
+// of the same partition.
+//
+// Blocks stay valid if they are passed to another thread, but then
+// threads share the locks of the partition again. The partition of an
+// exited thread goes to the next thread which asks for one, together with
+// the blocks the exited thread left there.
+//
+// Every partition is a manager with nine pools, and a process can have at
+// most 1023 pools (POOL_INDEX_BITS), so there are at most 113 partitions
+// in a process, fewer if it has other managers (memoryManager takes nine
+// pools too when it's initialized).
+// --------------------------------------------------------
+class ThreadPartitions {
+    friend struct ThreadExit;
+
+    const size_t partitionSize;
+    const size_t maxPartitions;
+    const SwapConfig config;
+    const uint64_t serial; // tells instances apart in the thread cache
+
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<MemoryManager>> partitions;
+    std::map<std::thread::id, MemoryManager *> byThread;
+    std::vector<MemoryManager *> released; // of exited threads
+
+    MemoryManager &registerThread();
+    void releaseThread(std::thread::id thread);
+
+  public:
+    // Each of `maxThreads` partitions gets memoryLimit / maxThreads bytes.
+    // Throws std::invalid_argument if it's too small for the pools.
+    ThreadPartitions(size_t memoryLimit, size_t maxThreads,
+                     const SwapConfig &config = SwapConfig{});
+    ThreadPartitions(const ThreadPartitions &) = delete;
+    ThreadPartitions &operator=(const ThreadPartitions &) = delete;
+    ~ThreadPartitions();
+
+    // Partition of the calling thread. Throws std::bad_alloc if all
+    // partitions are taken by other threads or the process can't have
+    // more pools.
+    MemoryManager &local();
+
+    size_t numPartitions() const;
+    void printStatistics() const;
+};
@@ -0,0 +1,146 @@
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "async_memory.hpp"
+
+namespace coro {
+
+//--------------------------------------------------------------
+// Executor
+//--------------------------------------------------------------
+Executor::Executor(size_t cpuThreads, size_t ioThreads)
+    : cpu(cpuThreads), io(ioThreads) {}
+
+void Executor::Post(std::function<void()> job) { cpu.Submit(std::move(job)); }
+
+void Executor::Resume(std::coroutine_handle<> handle) {
+    Post([handle]() { handle.resume(); });
+}
+
+void Executor::RunIo(std::function<void()> job) { io.Submit(std::move(job)); }
+
+//--------------------------------------------------------------
+// WhenAll
+//--------------------------------------------------------------
+detail::DetachedTask detail::RunOne(Task<void> task, WhenAllState &state) {
+    try {
+        co_await task;
+    } catch (...) {
+        std::lock_guard<std::mutex> guard(state.mutex);
+        if (!state.exception)
+            state.exception = std::current_exception();
+    }
+    if (--state.remaining == 0)
+        state.parent.resume();
+}
+
+detail::WhenAllAwaiter::WhenAllAwaiter(Executor &executor,
+                                       std::vector<Task<void>> &tasks)
+    : executor(executor), tasks(tasks) {}
+
+// The loop holds one extra count, otherwise the last task could resume
+// the parent (and destroy this awaiter with `tasks`) before the loop ends.
+// If the tasks are done by then, the parent just goes on.
+bool detail::WhenAllAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    state.remaining = tasks.size() + 1;
+    state.parent = handle;
+    for (Task<void> &task : tasks) {
+        executor.Post([this, &task]() { RunOne(std::move(task), state); });
+    }
+    return --state.remaining != 0;
+}
+
+void detail::WhenAllAwaiter::await_resume() {
+    if (state.exception)
+        std::rethrow_exception(state.exception);
+}
+
+Task<void> WhenAll(Executor &executor, std::vector<Task<void>> tasks) {
+    co_await detail::WhenAllAwaiter{executor, tasks};
+}
+
+//--------------------------------------------------------------
+// AsyncManager
+//--------------------------------------------------------------
+AsyncManager::AsyncManager(MemoryManager &manager, Executor &executor)
+    : manager(manager), executor(executor) {}
+
+AsyncManager::AllocateAwaiter AsyncManager::allocate(size_t size) {
+    return AllocateAwaiter{*this, size};
+}
+
+AsyncManager::AcquireAwaiter AsyncManager::acquire(MemoryBlock &block) {
+    return AcquireAwaiter{*this, block};
+}
+
+AsyncManager::FreeAwaiter AsyncManager::free(MemoryBlock &block) {
+    return FreeAwaiter{*this, block};
+}
+
+AsyncManager::AllocateAwaiter::AllocateAwaiter(AsyncManager &owner,
+                                               size_t size)
+    : owner(owner), size(size) {}
+
+void AsyncManager::AllocateAwaiter::await_suspend(
+    std::coroutine_handle<> handle) {
+    // getBlock() can swap out the oldest block, so it runs on io threads
+    owner.executor.RunIo([this, handle]() {
+        try {
+            block.emplace(owner.manager.getBlock(size));
+        } catch (...) {
+            exception = std::current_exception();
+        }
+        owner.executor.Resume(handle);
+    });
+}
+
+MemoryBlock AsyncManager::AllocateAwaiter::await_resume() {
+    if (exception)
+        std::rethrow_exception(exception);
+    return std::move(*block);
+}
+
+AsyncManager::AcquireAwaiter::AcquireAwaiter(AsyncManager &owner,
+                                             MemoryBlock &block)
+    : owner(owner), block(block), wasLocked(block.isLocked()) {}
+
+bool AsyncManager::AcquireAwaiter::await_ready() {
+    // fast path: the block is in ram and nobody holds its ram block
+    return wasLocked || block.tryLock();
+}
+
+void AsyncManager::AcquireAwaiter::await_suspend(
+    std::coroutine_handle<> handle) {
+    // the read starts now even if all io threads are busy
+    block.readAhead();
+    owner.executor.RunIo([this, handle]() {
+        try {
+            block.lock();
+        } catch (...) {
+            exception = std::current_exception();
+        }
+        owner.executor.Resume(handle);
+    });
+}
+
+Pin AsyncManager::AcquireAwaiter::await_resume() {
+    if (exception)
+        std::rethrow_exception(exception);
+    return Pin{block, !wasLocked};
+}
+
+AsyncManager::FreeAwaiter::FreeAwaiter(AsyncManager &owner, MemoryBlock &block)
+    : owner(owner), block(block) {}
+
+void AsyncManager::FreeAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    owner.executor.RunIo([this, handle]() {
+        block.free();
+        owner.executor.Resume(handle);
+    });
+}
+
+} // namespace coro
@@ -0,0 +1,359 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <functional>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../memory_manager/memory_manager.hpp"
+#include "../utils/thread_pool.hpp"
+
+namespace coro {
+
+//--------------------------------------------------------------
+// Executor: coroutines are resumed on a few cpu threads, while
+// blocking swap I/O (lock(), getBlock()) runs on io threads. The
+// swap I/O itself is synchronous: every pending swap-in holds one
+// io thread, so at most ioThreads swap-ins run at a time and the
+// rest wait in the io queue (cpu threads stay free meanwhile).
+//--------------------------------------------------------------
+class Executor {
+    utils::WorkStealingPool cpu;
+    utils::WorkStealingPool io;
+
+  public:
+    Executor(size_t cpuThreads, size_t ioThreads);
+
+    void Post(std::function<void()> job);
+    void Resume(std::coroutine_handle<> handle);
+    void RunIo(std::function<void()> job);
+};
+
+//--------------------------------------------------------------
+// Task<T>: lazy coroutine, starts when it's awaited and resumes
+// the awaiting coroutine when it's finished.
+//--------------------------------------------------------------
+template <typename T> class Task;
+
+namespace detail {
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr exception;
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            return handle.promise().continuation;
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { exception = std::current_exception(); }
+};
+
+template <typename T> struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    template <typename U> void return_value(U &&result) {
+        value.emplace(std::forward<U>(result));
+    }
+    T result() {
+        if (exception)
+            std::rethrow_exception(exception);
+        return std::move(*value);
+    }
+};
+
+template <> struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+    void result() {
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+};
+
+} // namespace detail
+
+template <typename T = void> class [[nodiscard]] Task {
+  public:
+    using promise_type = detail::Promise<T>;
+
+  private:
+    std::coroutine_handle<promise_type> handle;
+
+  public:
+    explicit Task(std::coroutine_handle<promise_type> handle)
+        : handle(handle) {}
+    Task(Task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+    Task &operator=(Task &&other) noexcept {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task() {
+        if (handle)
+            handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+    T await_resume() { return handle.promise().result(); }
+};
+
+template <typename T> Task<T> detail::Promise<T>::get_return_object() {
+    return Task<T>{std::coroutine_handle<Promise<T>>::from_promise(*this)};
+}
+
+inline Task<void> detail::Promise<void>::get_return_object() {
+    return Task<void>{
+        std::coroutine_handle<Promise<void>>::from_promise(*this)};
+}
+
+//--------------------------------------------------------------
+// Blocks the calling (non-coroutine) thread until the task is
+// finished, e.g. to wait for a set of tasks in main().
+//--------------------------------------------------------------
+namespace detail {
+
+struct SyncState {
+    std::mutex mutex;
+    std::condition_variable done;
+    bool finished = false;
+};
+
+// Signals the waiting thread only after the coroutine is suspended at
+// its final point, so the waiter can safely destroy it.
+struct SyncWaitTask {
+    struct promise_type {
+        SyncState *state = nullptr;
+
+        SyncWaitTask get_return_object() {
+            return SyncWaitTask{
+                std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        auto final_suspend() noexcept {
+            struct Signal {
+                bool await_ready() noexcept { return false; }
+                void await_suspend(
+                    std::coroutine_handle<promise_type> handle) noexcept {
+                    SyncState *state = handle.promise().state;
+                    std::lock_guard<std::mutex> guard(state->mutex);
+                    state->finished = true;
+                    state->done.notify_all();
+                }
+                void await_resume() noexcept {}
+            };
+            return Signal{};
+        }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+
+    explicit SyncWaitTask(std::coroutine_handle<promise_type> handle)
+        : handle(handle) {}
+    SyncWaitTask(const SyncWaitTask &) = delete;
+    SyncWaitTask &operator=(const SyncWaitTask &) = delete;
+    ~SyncWaitTask() { handle.destroy(); }
+};
+
+template <typename T> struct Storage {
+    std::optional<T> value;
+};
+template <> struct Storage<void> {};
+
+template <typename T>
+SyncWaitTask RunSync(Task<T> &task, Storage<T> &storage,
+                     std::exception_ptr &exception) {
+    try {
+        if constexpr (std::is_void_v<T>) {
+            co_await task;
+        } else {
+            storage.value.emplace(co_await task);
+        }
+    } catch (...) {
+        exception = std::current_exception();
+    }
+}
+
+} // namespace detail
+
+template <typename T> T SyncWait(Task<T> task) {
+    detail::SyncState state;
+    detail::Storage<T> storage;
+    std::exception_ptr exception;
+
+    detail::SyncWaitTask waiter = detail::RunSync(task, storage, exception);
+    waiter.handle.promise().state = &state;
+    waiter.handle.resume();
+
+    std::unique_lock<std::mutex> ul(state.mutex);
+    state.done.wait(ul, [&state]() { return state.finished; });
+    if (exception)
+        std::rethrow_exception(exception);
+    if constexpr (!std::is_void_v<T>) {
+        return std::move(*storage.value);
+    }
+}
+
+//--------------------------------------------------------------
+// WhenAll: runs tasks concurrently on the executor and resumes
+// the awaiting coroutine when all of them are finished. The first
+// exception (if any) is rethrown.
+//--------------------------------------------------------------
+namespace detail {
+
+struct WhenAllState {
+    std::atomic<size_t> remaining = 0;
+    std::coroutine_handle<> parent;
+    std::mutex mutex;
+    std::exception_ptr exception;
+};
+
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+DetachedTask RunOne(Task<void> task, WhenAllState &state);
+
+class WhenAllAwaiter {
+    Executor &executor;
+    std::vector<Task<void>> &tasks;
+    WhenAllState state;
+
+  public:
+    WhenAllAwaiter(Executor &executor, std::vector<Task<void>> &tasks);
+    bool await_ready() const noexcept { return tasks.empty(); }
+    bool await_suspend(std::coroutine_handle<> handle);
+    void await_resume();
+};
+
+} // namespace detail
+
+Task<void> WhenAll(Executor &executor, std::vector<Task<void>> tasks);
+
+//--------------------------------------------------------------
+// Pin: a locked block, it's unlocked when the pin is destroyed
+// (a block locked by the caller before acquire() stays locked).
+//--------------------------------------------------------------
+class Pin {
+    MemoryBlock *block; // to unlock, nullptr if it's not ours
+    MemoryBlock *pinned;
+
+  public:
+    Pin(MemoryBlock &block, bool owned)
+        : block(owned ? &block : nullptr), pinned(&block) {}
+    Pin(Pin &&other) noexcept
+        : block(std::exchange(other.block, nullptr)), pinned(other.pinned) {}
+    Pin &operator=(Pin &&other) noexcept {
+        std::swap(block, other.block);
+        std::swap(pinned, other.pinned);
+        return *this;
+    }
+    Pin(const Pin &) = delete;
+    Pin &operator=(const Pin &) = delete;
+    ~Pin() { release(); }
+
+    template <typename T = char> T *data() const {
+        return pinned->data<T>(); // the block is locked, no extra lock here
+    }
+    void release() {
+        if (block)
+            std::exchange(block, nullptr)->unlock();
+    }
+};
+
+//--------------------------------------------------------------
+// AsyncManager: awaitable versions of MemoryManager::getBlock()
+// and MemoryBlock::lock()
+//
+//     MemoryBlock block = co_await manager.allocate(size);
+//     coro::Pin pin = co_await manager.acquire(block);
+//     ...
+//     co_await manager.free(block);
+//
+// acquire() doesn't suspend at all when the block is in ram and
+// free, otherwise it hints the kernel to start reading the block
+// and the coroutine is suspended while an io thread waits for the
+// swap-in, then it's resumed on a cpu thread. Errors of lock()
+// (std::bad_alloc when the swap is full) are rethrown by co_await.
+//--------------------------------------------------------------
+class AsyncManager {
+    MemoryManager &manager;
+    Executor &executor;
+
+  public:
+    AsyncManager(MemoryManager &manager, Executor &executor);
+
+    class AllocateAwaiter {
+        AsyncManager &owner;
+        size_t size;
+        std::optional<MemoryBlock> block;
+        std::exception_ptr exception;
+
+      public:
+        AllocateAwaiter(AsyncManager &owner, size_t size);
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle);
+        MemoryBlock await_resume();
+    };
+
+    class AcquireAwaiter {
+        AsyncManager &owner;
+        MemoryBlock &block;
+        bool wasLocked;
+        std::exception_ptr exception;
+
+      public:
+        AcquireAwaiter(AsyncManager &owner, MemoryBlock &block);
+        bool await_ready();
+        void await_suspend(std::coroutine_handle<> handle);
+        Pin await_resume();
+    };
+
+    class FreeAwaiter {
+        AsyncManager &owner;
+        MemoryBlock &block;
+
+      public:
+        FreeAwaiter(AsyncManager &owner, MemoryBlock &block);
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume() {}
+    };
+
+    AllocateAwaiter allocate(size_t size);
+    AcquireAwaiter acquire(MemoryBlock &block);
+    // MemoryBlock::free() waits for the block's ram block too, so it must
+    // not be called on cpu threads
+    FreeAwaiter free(MemoryBlock &block);
+};
+
+} // namespace coro
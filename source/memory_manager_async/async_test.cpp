@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../utils/utils.hpp"
+#include "async_memory.hpp"
+
+//---------------------------------------------------------------
+// Runs a lot of logical tasks on a few threads: each task
+// allocates blocks, fills them and checks them again later. When
+// memory is low, most acquire() calls wait for swap-ins, but they
+// suspend coroutines instead of blocking threads.
+//---------------------------------------------------------------
+static char Pattern(size_t task, size_t block) {
+    return static_cast<char>((task * 31 + block * 7) % 251);
+}
+
+// Coroutines must not wait for anything on cpu threads, including the
+// manager mutex (MemoryManager::maxBlockSize() takes it), so the max block
+// size is read once in main()
+static size_t maxBlockSize = 0;
+
+coro::Task<void> Worker(coro::AsyncManager &manager, size_t task,
+                        size_t numBlocks, std::atomic<size_t> &errors) {
+    std::vector<MemoryBlock> blocks;
+    for (size_t i = 0; i < numBlocks; ++i) {
+        size_t size = 1 + (task * 131 + i * 17) % maxBlockSize;
+        MemoryBlock block = co_await manager.allocate(size);
+        {
+            coro::Pin pin = co_await manager.acquire(block);
+            std::memset(pin.data(), Pattern(task, i), block.size());
+        }
+        blocks.push_back(std::move(block));
+    }
+
+    for (size_t i = 0; i < numBlocks; ++i) {
+        coro::Pin pin = co_await manager.acquire(blocks[i]);
+        const char *data = pin.data();
+        bool ok = std::all_of(data, data + blocks[i].size(),
+                              [&](char c) { return c == Pattern(task, i); });
+        if (!ok)
+            ++errors;
+    }
+
+    for (MemoryBlock &block : blocks) {
+        co_await manager.free(block);
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t memorySizeMb = utils::CheckArgsAndGetMemorySize(argc, argv);
+    std::map<std::string, std::string> options =
+        utils::ParseOptions(argc, argv, 2);
+    size_t numTasks =
+        options.count("tasks") ? std::stoul(options["tasks"]) : 200;
+    size_t numBlocks =
+        options.count("blocks") ? std::stoul(options["blocks"]) : 32;
+    size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    memoryManager.init(memorySizeMb * 1024 * 1024);
+    maxBlockSize = memoryManager.maxBlockSize();
+
+    coro::Executor executor(numThreads, 2 * numThreads);
+    coro::AsyncManager manager(memoryManager, executor);
+    std::atomic<size_t> errors = 0;
+
+    utils::timer.start();
+    std::vector<coro::Task<void>> tasks;
+    for (size_t task = 0; task < numTasks; ++task) {
+        tasks.push_back(Worker(manager, task, numBlocks, errors));
+    }
+    coro::SyncWait(coro::WhenAll(executor, std::move(tasks)));
+
+    std::cout << "\n" << numTasks << " tasks x " << numBlocks
+              << " blocks completed in " << utils::hh_mm_ss{utils::timer.elapsed()}
+              << std::endl;
+    memoryManager.printStatistics();
+
+    if (errors > 0) {
+        std::cout << "There are " << errors << " corrupted blocks!"
+                  << std::endl;
+        return 1;
+    }
+    std::cout << "[Ok]" << std::endl;
+    return 0;
+}
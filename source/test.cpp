@@ -1,45 +1,112 @@
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <chrono>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "memory_manager/memory_manager.hpp"
+#include "memory_manager/thread_partitions.hpp"
+#include "utils/crc32c.hpp"
+#include "utils/thread_pool.hpp"
 #include "utils/utils.hpp"
 
 namespace fs = std::filesystem;
 using utils::Progress;
 
+SwapConfig ParseSwapTiers(const std::string &spec);
+size_t ParseNumber(const std::string &option, const std::string &value);
 void Prepare(const fs::path &inputDir);
+void CreateArenas(size_t numArenas, size_t memorySize,
+                  const SwapConfig &swapConfig);
+MemoryManager &ArenaFor(const fs::path &filename);
+void AssignTenants(const std::string &quota);
+void ApplyTenantQuota(const fs::path &filename);
+size_t TenantFor(const fs::path &filename);
+void ResetProgress(const fs::path &inputDir, const fs::path &outputDir);
 void CopyFilesInSingleThread(const fs::path &inputDir,
                              const fs::path &outputDir);
 void CopyFilesInMultipleThreads(const fs::path &inputDir,
                                 const fs::path &outputDir);
+void CopyFilesInThreadPool(const fs::path &inputDir, const fs::path &outputDir,
+                           size_t numWorkers);
 void CopyFile(const fs::path &inputFile, const fs::path &outputFile);
+void CopyFileRange(const fs::path &inputFile, const fs::path &outputFile,
+                   size_t offset, size_t length);
 
-std::vector<MemoryBlock> ReadFileByBlocks(const fs::path &inputFile);
+std::vector<MemoryBlock> ReadFileByBlocks(const fs::path &inputFile,
+                                          size_t offset, size_t length,
+                                          uint32_t *checksum);
 void WriteBlocksIntoFile(const std::vector<MemoryBlock> &blocks,
-                         const fs::path &outputFile);
+                         const fs::path &outputFile, size_t offset,
+                         uint32_t *checksum);
 void Free(std::vector<MemoryBlock> &blocks);
+uint32_t BlocksChecksum(const MemoryBlock *blocks, size_t count,
+                        uint32_t crc);
+uint32_t FileChecksum(int fd, size_t offset, size_t length);
+bool VerifyChecksums();
 
 void PrintStatisticsAndProgress();
 void DisplayInformation();
+void StopDisplayInformation();
 
 //---------------------------------------------------------------
 // The main() function is here with some global variables just
 // to control threads execution and display their progress.
 //---------------------------------------------------------------
 static std::atomic<bool> finished = false;
+static std::mutex finishedMutex;
+static std::condition_variable finishedCondition;
 static std::map<fs::path, std::shared_ptr<Progress>> progressMap;
 
+// With --arenas=N files are copied by N independent managers (the RAM
+// limit is split between them), otherwise by the global one
+static std::vector<std::unique_ptr<MemoryManager>> arenas;
+static std::map<fs::path, MemoryManager *> arenaMap;
+
+// In the partitioned mode every thread copies its file with its own
+// partition of the RAM limit
+static std::unique_ptr<ThreadPartitions> partitions;
+
+// With --tenant-quota every file is copied as its own tenant, with the
+// same quota in whichever manager copies it
+static std::map<fs::path, size_t> tenantMap;
+static size_t tenantReserved = 0;
+static size_t tenantLimit = SIZE_MAX;
+static std::atomic<bool> tenantQuotaFailed = false;
+
+// With verification (on by default) a range's checksum is computed twice:
+// of the blocks just read from the input file and of the blocks being
+// written to the output one, so files are never read again to check them
+struct RangeChecksums {
+    size_t offset;
+    size_t length;
+    uint32_t input;
+    uint32_t output;
+};
+static bool verify = true;
+static std::mutex checksumMutex;
+static std::map<fs::path, std::vector<RangeChecksums>> checksumMap;
+
+// Files are split into ranges of this size for the thread pool
+static const size_t RANGE_SIZE = 4 * 1024 * 1024;
+
 int main(int argc, char **argv) {
     setlocale(0, "");
 
@@ -49,20 +116,184 @@ int main(int argc, char **argv) {
     utils::CreateDirectoryIfNotExists(outputDir);
 
     size_t memorySizeMb = utils::CheckArgsAndGetMemorySize(argc, argv);
-    memoryManager.init(memorySizeMb * 1024 * 1024);
+    std::map<std::string, std::string> options =
+        utils::ParseOptions(argc, argv, 2);
+    const std::string mode =
+        options.count("mode") ? options["mode"] : std::string("pool");
+    size_t numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    if (options.count("workers")) {
+        numWorkers =
+            std::max<size_t>(1, ParseNumber("workers", options["workers"]));
+    }
 
-    utils::timer.start();
+    size_t numArenas = 0;
+    if (options.count("arenas")) {
+        numArenas =
+            std::max<size_t>(1, ParseNumber("arenas", options["arenas"]));
+    }
+    SwapConfig swapConfig;
+    if (options.count("swap-tiers")) {
+        swapConfig = ParseSwapTiers(options["swap-tiers"]);
+    }
+    if (options.count("direct-io")) {
+        swapConfig.directIo = options["direct-io"] != "0";
+    }
+    if (options.count("checksums")) {
+        swapConfig.checksums = options["checksums"] != "0";
+    }
+    if (options.count("verify")) {
+        verify = options["verify"] != "0";
+    }
 
     Prepare(inputDir);
-    CopyFilesInMultipleThreads(inputDir, outputDir);
-    //    CopyFilesInSingleThread(inputDir, outputDir);
+    if (options.count("tenant-quota")) {
+        AssignTenants(options["tenant-quota"]);
+    }
 
-    std::cout << "\nCopying completed in "
-              << utils::hh_mm_ss{utils::timer.elapsed()} << "\n"
-              << std::endl;
+    // every mode copies the same files, so they can be compared in one run.
+    // The partitioned one goes first: the global manager can't be released,
+    // and both designs must get the same RAM limit.
+    std::vector<std::string> modes = {mode};
+    if (mode == "compare") {
+        modes = {"partitioned", "single", "per-file", "pool"};
+    }
+    bool sharedManagers = false; // the global one or arenas
+
+    utils::Table summary({14, 10, 16, 14});
+    summary << utils::hr << "Mode"
+            << "Threads"
+            << "Time"
+            << "Speed" << utils::hr;
+    for (const std::string &m : modes) {
+        if (m != "partitioned" && !sharedManagers) {
+            if (numArenas == 0) {
+                memoryManager.init(memorySizeMb * 1024 * 1024, swapConfig);
+            } else {
+                CreateArenas(numArenas, memorySizeMb * 1024 * 1024,
+                             swapConfig);
+            }
+            try {
+                for (const auto &[filename, progress] : progressMap) {
+                    ApplyTenantQuota(filename);
+                }
+            } catch (const std::invalid_argument &e) {
+                std::cerr << "--tenant-quota: " << e.what() << std::endl;
+                return 1;
+            }
+            if (options.count("stats-file")) {
+                // every arena gets its own file
+                const std::string statsFile = options["stats-file"];
+                if (arenas.empty()) {
+                    memoryManager.publishStatistics(statsFile);
+                }
+                for (size_t i = 0; i < arenas.size(); ++i) {
+                    arenas.at(i)->publishStatistics(statsFile + "." +
+                                                    std::to_string(i));
+                }
+            }
+            sharedManagers = true;
+        }
+        ResetProgress(inputDir, outputDir);
+        utils::timer.start();
+
+        size_t numThreads = 1;
+        if (m == "single") {
+            CopyFilesInSingleThread(inputDir, outputDir);
+        } else if (m == "per-file") {
+            numThreads = progressMap.size();
+            CopyFilesInMultipleThreads(inputDir, outputDir);
+        } else if (m == "pool") {
+            numThreads = numWorkers;
+            CopyFilesInThreadPool(inputDir, outputDir, numWorkers);
+        } else if (m == "partitioned") {
+            numThreads = progressMap.size();
+            try {
+                partitions = std::make_unique<ThreadPartitions>(
+                    memorySizeMb * 1024 * 1024, numThreads, swapConfig);
+            } catch (const std::invalid_argument &e) {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
+            CopyFilesInMultipleThreads(inputDir, outputDir);
+            partitions.reset();
+            if (tenantQuotaFailed)
+                return 1;
+        } else {
+            std::cerr << "Unknown mode '" << m << "'" << std::endl;
+            return 1;
+        }
+
+        std::chrono::milliseconds elapsed = utils::timer.elapsed();
+        std::cout << "\nCopying completed in " << utils::hh_mm_ss{elapsed}
+                  << "\n"
+                  << std::endl;
+
+        size_t totalSize = 0;
+        for (const auto &[filename, progress] : progressMap) {
+            totalSize += progress->size;
+        }
+        size_t bytesPerSecond =
+            totalSize * 1000 / std::max<size_t>(1, elapsed.count());
+        summary << m << numThreads << utils::hh_mm_ss{elapsed}
+                << (std::to_string(bytesPerSecond / 1024) + " KB/s");
+
+        if (verify && !VerifyChecksums()) {
+            std::cerr << "Output files differ from input ones" << std::endl;
+            return 1;
+        }
+    }
+
+    if (modes.size() > 1) {
+        summary << utils::hr;
+        std::cout << "Comparison of copy modes:\n" << summary << std::endl;
+    }
     return 0;
 }
 
+// Tiers are separated by ',' from the fastest to the slowest one, each
+// tier is a '+' separated list of directories with an optional capacity
+// in megabytes after ':', e.g. "/mnt/nvme0+/mnt/nvme1:512,/mnt/hdd".
+SwapConfig ParseSwapTiers(const std::string &spec) {
+    SwapConfig config;
+    std::stringstream tiers(spec);
+    std::string tierSpec;
+    while (std::getline(tiers, tierSpec, ',')) {
+        SwapTier tier;
+        size_t colon = tierSpec.find(':');
+        if (colon != std::string::npos) {
+            tier.capacity =
+                ParseNumber("swap-tiers", tierSpec.substr(colon + 1)) * 1024 *
+                1024;
+            tierSpec.resize(colon);
+        }
+        std::stringstream dirs(tierSpec);
+        std::string dir;
+        while (std::getline(dirs, dir, '+')) {
+            if (!dir.empty())
+                tier.dirs.push_back(dir);
+        }
+        if (tier.dirs.empty()) {
+            std::cerr << "Wrong swap tier '" << tierSpec << "'" << std::endl;
+            exit(1);
+        }
+        config.tiers.push_back(tier);
+    }
+    return config;
+}
+
+// A non-negative integer value of an option, exits on anything else
+size_t ParseNumber(const std::string &option, const std::string &value) {
+    size_t number = 0;
+    std::istringstream iss(value);
+    iss >> number;
+    if (value.empty() || value[0] == '-' || iss.fail() || !iss.eof()) {
+        std::cerr << "--" << option << ": wrong number '" << value << "'"
+                  << std::endl;
+        exit(1);
+    }
+    return number;
+}
+
 void Prepare(const fs::path &inputDir) {
     std::cout << "List of files in input folder '" << inputDir
               << "':" << std::endl;
@@ -75,29 +306,92 @@ void Prepare(const fs::path &inputDir) {
     }
 }
 
+// Files are assigned to arenas in turn
+void CreateArenas(size_t numArenas, size_t memorySize,
+                  const SwapConfig &swapConfig) {
+    for (size_t i = 0; i < numArenas; ++i) {
+        arenas.push_back(std::make_unique<MemoryManager>(
+            memorySize / numArenas, swapConfig));
+    }
+    size_t i = 0;
+    for (const auto &[filename, progress] : progressMap) {
+        arenaMap[filename] = arenas.at(i++ % numArenas).get();
+    }
+}
+
+MemoryManager &ArenaFor(const fs::path &filename) {
+    if (partitions)
+        return partitions->local();
+    if (arenas.empty())
+        return memoryManager;
+    return *arenaMap.at(filename);
+}
+
+// The quota is "RESERVED_KB[:LIMIT_KB]", the same for every file
+void AssignTenants(const std::string &quota) {
+    size_t colon = quota.find(':');
+    tenantReserved =
+        ParseNumber("tenant-quota", quota.substr(0, colon)) * 1024;
+    if (colon != std::string::npos) {
+        tenantLimit =
+            ParseNumber("tenant-quota", quota.substr(colon + 1)) * 1024;
+    }
+
+    size_t i = 0;
+    for (const auto &[filename, progress] : progressMap) {
+        // tenant 0 is the default one
+        tenantMap[filename] = 1 + i++ % (MAX_TENANTS - 1);
+    }
+}
+
+// Sets the quota of the file's tenant in the manager which copies it, in
+// the partitioned mode it's the partition of the calling thread. Throws
+// std::invalid_argument if the quota doesn't fit into the manager.
+void ApplyTenantQuota(const fs::path &filename) {
+    auto it = tenantMap.find(filename);
+    if (it != end(tenantMap)) {
+        ArenaFor(filename).setTenantQuota(it->second, tenantReserved,
+                                          tenantLimit);
+    }
+}
+
+size_t TenantFor(const fs::path &filename) {
+    auto it = tenantMap.find(filename);
+    return it != end(tenantMap) ? it->second : 0;
+}
+
+// Output files are created with their final size up front, so ranges of
+// one file can be written independently by different threads.
+void ResetProgress(const fs::path &inputDir, const fs::path &outputDir) {
+    finished = false;
+    for (auto &[filename, progress] : progressMap) {
+        progress->size = fs::file_size(inputDir / filename);
+        progress->read = 0;
+        progress->write = 0;
+
+        std::ofstream tmp(outputDir / filename, std::ios::binary);
+        tmp.close();
+        fs::resize_file(outputDir / filename, progress->size);
+    }
+}
+
 void CopyFilesInSingleThread(const fs::path &inputDir,
                              const fs::path &outputDir) {
     std::thread infoThread(DisplayInformation);
-    for (const auto &entry : fs::directory_iterator(inputDir)) {
-        if (fs::is_regular_file(entry.path())) {
-            const fs::path filename = entry.path().filename();
-            CopyFile(inputDir / filename, outputDir / filename);
-        }
+    for (const auto &[filename, progress] : progressMap) {
+        CopyFile(inputDir / filename, outputDir / filename);
     }
 
-    finished = true;
+    StopDisplayInformation();
     infoThread.join();
 }
 
 void CopyFilesInMultipleThreads(const fs::path &inputDir,
                                 const fs::path &outputDir) {
     std::vector<std::thread> threads;
-    for (const auto &entry : fs::directory_iterator(inputDir)) {
-        if (fs::is_regular_file(entry.path())) {
-            const fs::path filename = entry.path().filename();
-            threads.emplace_back(CopyFile, inputDir / filename,
-                                 outputDir / filename);
-        }
+    for (const auto &[filename, progress] : progressMap) {
+        threads.emplace_back(CopyFile, inputDir / filename,
+                             outputDir / filename);
     }
     std::cout << "\nStarted copying in " << threads.size() << " threads..."
               << std::endl;
@@ -109,7 +403,35 @@ void CopyFilesInMultipleThreads(const fs::path &inputDir,
     }
     threads.clear();
 
-    finished = true;
+    StopDisplayInformation();
+    infoThread.join();
+}
+
+// Large files are split into independent ranges, so a few big files are
+// balanced between all workers and many small files don't need a thread
+// each.
+void CopyFilesInThreadPool(const fs::path &inputDir, const fs::path &outputDir,
+                           size_t numWorkers) {
+    utils::WorkStealingPool pool(numWorkers);
+    std::cout << "\nStarted copying in " << pool.NumWorkers()
+              << " worker threads..." << std::endl;
+
+    std::thread infoThread(DisplayInformation);
+
+    for (const auto &[filename, progress] : progressMap) {
+        const fs::path inputFile = inputDir / filename;
+        const fs::path outputFile = outputDir / filename;
+        const size_t filesize = progress->size;
+        for (size_t offset = 0; offset < filesize; offset += RANGE_SIZE) {
+            size_t length = std::min(RANGE_SIZE, filesize - offset);
+            pool.Submit([inputFile, outputFile, offset, length]() {
+                CopyFileRange(inputFile, outputFile, offset, length);
+            });
+        }
+    }
+    pool.Wait();
+
+    StopDisplayInformation();
     infoThread.join();
 }
 
@@ -120,57 +442,113 @@ void CopyFilesInMultipleThreads(const fs::path &inputDir,
 // 3. free blocks
 //-------------------------------------------------------------------------
 void CopyFile(const fs::path &inputFile, const fs::path &outputFile) {
-    std::vector<MemoryBlock> blocks = ReadFileByBlocks(inputFile);
-    WriteBlocksIntoFile(blocks, outputFile);
+    if (partitions) {
+        // the file is not copied, main() fails after all threads are done
+        try {
+            ApplyTenantQuota(inputFile.filename());
+        } catch (const std::invalid_argument &e) {
+            std::cerr << "--tenant-quota: " << e.what() << std::endl;
+            tenantQuotaFailed = true;
+            return;
+        }
+    }
+    CopyFileRange(inputFile, outputFile, 0, fs::file_size(inputFile));
+}
+
+void CopyFileRange(const fs::path &inputFile, const fs::path &outputFile,
+                   size_t offset, size_t length) {
+    TenantScope tenant(TenantFor(inputFile.filename()));
+    RangeChecksums range{offset, length, 0, 0};
+    std::vector<MemoryBlock> blocks = ReadFileByBlocks(
+        inputFile, offset, length, verify ? &range.input : nullptr);
+    WriteBlocksIntoFile(blocks, outputFile, offset,
+                        verify ? &range.output : nullptr);
     Free(blocks);
+
+    if (verify) {
+        std::lock_guard<std::mutex> guard(checksumMutex);
+        checksumMap[inputFile.filename()].push_back(range);
+    }
 }
 
-std::vector<MemoryBlock> ReadFileByBlocks(const fs::path &inputFile) {
-    std::ifstream fin(inputFile, std::ios::binary);
-    if (!fin) {
+// Blocks are allocated and filled in batches: one readv()/writev() call
+// moves the whole batch instead of one stream call per block.
+static const size_t BLOCKS_PER_BATCH = 64;
+
+std::vector<MemoryBlock> ReadFileByBlocks(const fs::path &inputFile,
+                                          size_t offset, size_t length,
+                                          uint32_t *checksum) {
+    int fd = open(inputFile.c_str(), O_RDONLY);
+    if (fd < 0 || lseek(fd, offset, SEEK_SET) < 0) {
         std::cerr << "Can't open file " << inputFile << " for reading"
                   << std::endl;
         exit(1);
     }
     std::shared_ptr<Progress> progress = progressMap[inputFile.filename()];
+    MemoryManager &manager = ArenaFor(inputFile.filename());
 
-    size_t filesize = utils::FileSize(fin);
-    progress->size = filesize;
     size_t read = 0;
-
     std::vector<MemoryBlock> blocks;
-    while (read < filesize) {
-        size_t size = 1 + rand() % memoryManager.maxBlockSize();
-        size = std::min(size, filesize - read);
-
+    while (read < length) {
         // Allocating memory
-        MemoryBlock block = memoryManager.getBlock(size);
-
-        fin.read(block.data(), size);
-        read += size;
-        progress->read = read;
+        size_t first = blocks.size();
+        size_t batchSize = 0;
+        while (read + batchSize < length &&
+               blocks.size() - first < BLOCKS_PER_BATCH) {
+            size_t size = 1 + rand() % manager.maxBlockSize();
+            size = std::min(size, length - read - batchSize);
+            blocks.push_back(manager.getBlock(size));
+            batchSize += size;
+        }
 
-        blocks.push_back(std::move(block));
+        size_t done =
+            manager.readInto(fd, &blocks.at(first), blocks.size() - first);
+        if (done != batchSize) {
+            std::cerr << "Can't read file " << inputFile << std::endl;
+            exit(1);
+        }
+        if (checksum) {
+            *checksum = BlocksChecksum(&blocks.at(first),
+                                       blocks.size() - first, *checksum);
+        }
+        read += done;
+        progress->read += done;
     }
-    fin.close();
+    close(fd);
     return blocks;
 }
 
 void WriteBlocksIntoFile(const std::vector<MemoryBlock> &blocks,
-                         const fs::path &outputFile) {
-    std::ofstream fout(outputFile, std::ios::binary);
-    if (!fout) {
+                         const fs::path &outputFile, size_t offset,
+                         uint32_t *checksum) {
+    int fd = open(outputFile.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || lseek(fd, offset, SEEK_SET) < 0) {
         std::cerr << "Can't open file " << outputFile << " for writing"
                   << std::endl;
         exit(1);
     }
     std::shared_ptr<Progress> progress = progressMap[outputFile.filename()];
+    MemoryManager &manager = ArenaFor(outputFile.filename());
 
-    for (const auto &block : blocks) {
-        fout.write(block.data(), block.size());
-        progress->write += block.size();
+    size_t written = 0;
+    for (size_t first = 0; first < blocks.size();
+         first += BLOCKS_PER_BATCH) {
+        size_t count = std::min(BLOCKS_PER_BATCH, blocks.size() - first);
+        size_t batchSize = 0;
+        for (size_t i = first; i < first + count; ++i)
+            batchSize += blocks[i].size();
+        size_t done = manager.writeFrom(fd, &blocks.at(first), count);
+        if (done != batchSize) {
+            std::cerr << "Can't write file " << outputFile << std::endl;
+            exit(1);
+        }
+        written += done;
+        progress->write += done;
     }
-    fout.close();
+    // the written range is read back, so a corrupted write is caught too
+    if (checksum)
+        *checksum = FileChecksum(fd, offset, written);
+    close(fd);
 }
 
 void Free(std::vector<MemoryBlock> &blocks) {
@@ -179,17 +557,104 @@ void Free(std::vector<MemoryBlock> &blocks) {
     }
 }
 
+uint32_t BlocksChecksum(const MemoryBlock *blocks, size_t count,
+                        uint32_t crc) {
+    for (size_t i = 0; i < count; ++i) {
+        auto data = blocks[i].data<const char>();
+        crc = utils::Crc32c(data, blocks[i].size(), crc);
+    }
+    return crc;
+}
+
+uint32_t FileChecksum(int fd, size_t offset, size_t length) {
+    std::vector<char> buffer(1 << 16);
+    uint32_t crc = 0;
+    for (size_t done = 0; done < length;) {
+        size_t size = std::min(buffer.size(), length - done);
+        ssize_t n = pread(fd, buffer.data(), size, offset + done);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            std::cerr << "Can't read back the written file" << std::endl;
+            exit(1);
+        }
+        crc = utils::Crc32c(buffer.data(), n, crc);
+        done += n;
+    }
+    return crc;
+}
+
+// Checksums of ranges are combined in the order of offsets into checksums
+// of whole files, it doesn't matter which threads copied the ranges
+bool VerifyChecksums() {
+    std::lock_guard<std::mutex> guard(checksumMutex);
+    utils::Table table({24, 14, 14, 8});
+    table << utils::hr << "File"
+          << "CRC32C in"
+          << "CRC32C out"
+          << "Status" << utils::hr;
+    bool ok = true;
+    for (auto &[filename, ranges] : checksumMap) {
+        std::sort(begin(ranges), end(ranges),
+                  [](const RangeChecksums &a, const RangeChecksums &b) {
+                      return a.offset < b.offset;
+                  });
+        uint32_t input = 0;
+        uint32_t output = 0;
+        for (const RangeChecksums &range : ranges) {
+            input = utils::Crc32cCombine(input, range.input, range.length);
+            output = utils::Crc32cCombine(output, range.output, range.length);
+        }
+        std::ostringstream in, out;
+        in << std::hex << input;
+        out << std::hex << output;
+        table << filename.string() << in.str() << out.str()
+              << (input == output ? "ok" : "FAILED");
+        ok = ok && input == output;
+    }
+    table << utils::hr;
+    std::cout << "Checksums ("
+              << (utils::Crc32cIsAccelerated() ? "sse4.2" : "software")
+              << "):\n"
+              << table << std::endl;
+    checksumMap.clear();
+    return ok;
+}
+
 void DisplayInformation() {
+    std::unique_lock<std::mutex> ul(finishedMutex);
     while (!finished) {
+        ul.unlock();
         PrintStatisticsAndProgress();
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        ul.lock();
+        // wakes up at once when copying is finished, so the measured
+        // time doesn't depend on the refresh period
+        finishedCondition.wait_for(ul, std::chrono::seconds(1),
+                                   []() { return finished.load(); });
     }
+    ul.unlock();
     PrintStatisticsAndProgress();
 }
 
+void StopDisplayInformation() {
+    {
+        std::lock_guard<std::mutex> guard(finishedMutex);
+        finished = true;
+    }
+    finishedCondition.notify_all();
+}
+
 void PrintStatisticsAndProgress() {
     std::cout << "\nMemory pool statistics:" << std::endl;
-    memoryManager.printStatistics();
+    if (partitions) {
+        partitions->printStatistics();
+    } else if (arenas.empty()) {
+        memoryManager.printStatistics();
+    }
+    for (size_t i = 0; i < arenas.size() && !partitions; ++i) {
+        std::cout << "Arena " << i << ":" << std::endl;
+        arenas.at(i)->printStatistics();
+    }
     std::cout << "\nCopy folder test progress:" << std::endl;
     utils::ShowProgress(progressMap);
 }
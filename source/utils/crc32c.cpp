@@ -0,0 +1,128 @@
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC32C_HAS_SSE42_KERNEL 1
+#endif
+
+#include "crc32c.hpp"
+
+namespace utils {
+
+// reflected polynomial of CRC32C
+static const uint32_t POLYNOMIAL = 0x82f63b78;
+
+// Tables for slicing by 8: table[k][b] is the crc of byte b followed by k
+// zero bytes
+using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+static Tables MakeTables() {
+    Tables table{};
+    for (uint32_t b = 0; b < 256; ++b) {
+        uint32_t crc = b;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (POLYNOMIAL & (0 - (crc & 1)));
+        table[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; ++b) {
+        for (size_t k = 1; k < table.size(); ++k)
+            table[k][b] = (table[k - 1][b] >> 8) ^
+                          table[0][table[k - 1][b] & 0xff];
+    }
+    return table;
+}
+
+static uint32_t Crc32cSoftware(const unsigned char *data, size_t size,
+                               uint32_t crc) {
+    static const Tables table = MakeTables();
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        word ^= crc; // little endian: the crc covers the first 4 bytes
+        crc = table[7][word & 0xff] ^ table[6][(word >> 8) & 0xff] ^
+              table[5][(word >> 16) & 0xff] ^ table[4][(word >> 24) & 0xff] ^
+              table[3][(word >> 32) & 0xff] ^ table[2][(word >> 40) & 0xff] ^
+              table[1][(word >> 48) & 0xff] ^ table[0][word >> 56];
+    }
+    for (; size > 0; --size, ++data)
+        crc = (crc >> 8) ^ table[0][(crc ^ *data) & 0xff];
+    return crc;
+}
+
+#ifdef CRC32C_HAS_SSE42_KERNEL
+__attribute__((target("sse4.2"))) static uint32_t
+Crc32cSse42(const unsigned char *data, size_t size, uint32_t crc) {
+    uint64_t crc64 = crc;
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = static_cast<uint32_t>(crc64);
+    for (; size > 0; --size, ++data)
+        crc = _mm_crc32_u8(crc, *data);
+    return crc;
+}
+#endif
+
+using Kernel = uint32_t (*)(const unsigned char *, size_t, uint32_t);
+
+static Kernel SelectKernel() {
+#ifdef CRC32C_HAS_SSE42_KERNEL
+    if (__builtin_cpu_supports("sse4.2"))
+        return Crc32cSse42;
+#endif
+    return Crc32cSoftware;
+}
+
+static const Kernel kernel = SelectKernel();
+
+// Multiplication of polynomials modulo the CRC polynomial, bits are
+// reflected as in the crc itself (as in zlib's crc32_combine)
+static uint32_t MultiplyModP(uint32_t a, uint32_t b) {
+    uint32_t m = uint32_t(1) << 31;
+    uint32_t p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ POLYNOMIAL : b >> 1;
+    }
+    return p;
+}
+
+// x^(8 * size) modulo the polynomial
+static uint32_t ShiftBytesModP(size_t size) {
+    // powers[k] = x^(2^k)
+    static const std::array<uint32_t, 64> powers = []() {
+        std::array<uint32_t, 64> table{};
+        uint32_t p = uint32_t(1) << 30; // x^1
+        for (uint32_t &power : table) {
+            power = p;
+            p = MultiplyModP(p, p);
+        }
+        return table;
+    }();
+    uint32_t p = uint32_t(1) << 31; // x^0
+    for (size_t k = 3; size != 0; size >>= 1, ++k) {
+        if (size & 1)
+            p = MultiplyModP(powers[k], p);
+    }
+    return p;
+}
+
+uint32_t Crc32cCombine(uint32_t crc1, uint32_t crc2, size_t size2) {
+    return MultiplyModP(ShiftBytesModP(size2), crc1) ^ crc2;
+}
+
+uint32_t Crc32c(const void *data, size_t size, uint32_t crc) {
+    return ~kernel(static_cast<const unsigned char *>(data), size, ~crc);
+}
+
+bool Crc32cIsAccelerated() { return kernel != Crc32cSoftware; }
+
+} // namespace utils
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace utils {
+//--------------------------------------------------------------
+// CRC32C (Castagnoli) checksum. It uses the SSE4.2 crc32
+// instruction if the CPU has it (checked once at run time) and
+// a table driven implementation otherwise. A checksum of data
+// split into parts is computed by passing the previous result:
+//     crc = Crc32c(part2, size2, Crc32c(part1, size1));
+//--------------------------------------------------------------
+uint32_t Crc32c(const void *data, size_t size, uint32_t crc = 0);
+
+// Checksum of two concatenated parts from checksums of the parts, so parts
+// can be checksummed independently (e.g. by different threads)
+uint32_t Crc32cCombine(uint32_t crc1, uint32_t crc2, size_t size2);
+
+// true if the hardware implementation is used
+bool Crc32cIsAccelerated();
+
+} // namespace utils
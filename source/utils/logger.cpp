@@ -1,20 +1,132 @@
+#include <chrono>
 #include <iostream>
 #include <mutex>
-#include <sstream>
 
 #include "logger.hpp"
 
-Logger::Logger(std::ostream &str) : output(str) {}
+// records are formatted in batches, so a thread rarely wakes up
+static const std::chrono::milliseconds DRAIN_PERIOD{10};
 
-void Logger::Flush() { output.flush(); }
+static const char *LevelName(LogLevel level) {
+    switch (level) {
+    case LogLevel::Debug:
+        return "Debug";
+    case LogLevel::Info:
+        return "Info";
+    case LogLevel::Error:
+        return "ERROR";
+    default:
+        return "";
+    }
+}
 
-void Logger::Lock() { mutex.lock(); }
+Logger::Logger(std::ostream &str) : output(str) {}
 
-void Logger::Unlock() {
-    output << str();
-    str("");
+Logger::~Logger() {
+    std::unique_lock<std::mutex> ul(mutex);
+    stopping = true;
+    ul.unlock();
+    wakeUp.notify_one();
+    if (drainThread.joinable())
+        drainThread.join();
     Flush();
-    mutex.unlock();
+}
+
+// The ring is registered once per thread, later records only take the
+// thread local pointer
+LogRing &Logger::LocalRing() {
+    struct Owner {
+        Logger *logger = nullptr;
+        std::shared_ptr<LogRing> ring;
+        ~Owner() {
+            if (ring)
+                ring->finished = true;
+        }
+    };
+    static thread_local Owner owner;
+    if (owner.logger == this)
+        return *owner.ring;
+
+    auto ring = std::make_shared<LogRing>();
+    std::lock_guard<std::mutex> guard(mutex);
+    ring->number = numThreads++;
+    rings.push_back(ring);
+    if (!drainThread.joinable() && !stopping)
+        drainThread = std::thread(&Logger::DrainLoop, this);
+    if (owner.ring)
+        owner.ring->finished = true;
+    owner.logger = this;
+    owner.ring = ring;
+    return *ring;
+}
+
+void Logger::DrainLoop() {
+    std::unique_lock<std::mutex> ul(mutex);
+    while (!stopping) {
+        wakeUp.wait_for(ul, DRAIN_PERIOD);
+        DrainRings();
+    }
+}
+
+// the mutex must be held by the caller
+void Logger::DrainRings() {
+    bool printed = false;
+    for (size_t i = 0; i < rings.size();) {
+        LogRing &ring = *rings[i];
+        bool finished = ring.finished; // before the last records are read
+        size_t tail = ring.tail.load(std::memory_order_relaxed);
+        size_t head = ring.head.load(std::memory_order_acquire);
+        for (; tail != head; ++tail) {
+            Print(ring, ring.records[tail % LogRing::SIZE]);
+            ring.tail.store(tail + 1, std::memory_order_release);
+            printed = true;
+        }
+        if (size_t dropped = ring.dropped.exchange(0)) {
+            output << "[logger: " << dropped << " records of thread "
+                   << ring.number << " are dropped]\n";
+            printed = true;
+        }
+        if (finished) {
+            rings.erase(rings.begin() + i);
+        } else {
+            ++i;
+        }
+    }
+    if (printed)
+        output.flush();
+}
+
+void Logger::Print(const LogRing &ring, const LogRecord &record) {
+    output << "\n[logger: " << record.file << " line: " << record.line
+           << " thread: " << ring.number << "]\n"
+           << LevelName(record.level) << ": ";
+    size_t arg = 0;
+    for (const char *c = record.format; *c; ++c) {
+        if (c[0] == '{' && c[1] == '}' && arg < record.numArgs) {
+            uint64_t value = record.args[arg];
+            switch (record.argType[arg]) {
+            case 'i':
+                output << static_cast<int64_t>(value);
+                break;
+            case 'p':
+                output << reinterpret_cast<void *>(value);
+                break;
+            default:
+                output << value;
+            }
+            ++arg;
+            ++c;
+        } else {
+            output << *c;
+        }
+    }
+    output << "\n";
+}
+
+void Logger::Flush() {
+    std::lock_guard<std::mutex> guard(mutex);
+    DrainRings();
+    output.flush();
 }
 
 Logger logger{std::cout};
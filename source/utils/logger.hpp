@@ -1,25 +1,142 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <mutex>
-#include <sstream>
+#include <ostream>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
-#define LOG_BEGIN                                                              \
-    logger.Lock();                                                             \
-    logger << "\n[logger: " << __FILE__ << " line: " << __LINE__ << "]\n";     \
-    logger.Flush();
+//--------------------------------------------------------------
+// Levels of log messages. Calls below LOG_LEVEL (set it with
+// -DLOG_LEVEL=LOG_LEVEL_ERROR etc.) are dropped at compile time,
+// LOG_LEVEL_NONE drops all of them.
+//--------------------------------------------------------------
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_ERROR 2
+#define LOG_LEVEL_NONE 3
 
-#define LOG_END logger.Unlock();
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
 
-class Logger : public std::ostringstream {
+enum class LogLevel : uint8_t { Debug, Info, Error, None };
+
+constexpr LogLevel LOG_MIN_LEVEL = static_cast<LogLevel>(LOG_LEVEL);
+
+// A message is a static format string where "{}" are replaced with the
+// arguments (integers or pointers), e.g.
+//     LOG_INFO("block {} of pool {} is locked", frame, pool);
+#define LOG_AT(level, ...)                                                     \
+    do {                                                                       \
+        if constexpr (level >= LOG_MIN_LEVEL)                                  \
+            logger.Write(level, __FILE__, __LINE__, __VA_ARGS__);              \
+    } while (false)
+
+#define LOG_DEBUG(...) LOG_AT(LogLevel::Debug, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LogLevel::Info, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LogLevel::Error, __VA_ARGS__)
+
+constexpr size_t LOG_MAX_ARGS = 4;
+
+// One message as it's stored by the thread which logs it, it's formatted
+// later by the drain thread
+struct LogRecord {
+    const char *format;
+    const char *file;
+    uint32_t line;
+    LogLevel level;
+    uint8_t numArgs;
+    char argType[LOG_MAX_ARGS]; // 'i' - signed, 'u' - unsigned, 'p' - pointer
+    uint64_t args[LOG_MAX_ARGS];
+};
+
+// Records of one thread: it's the only writer of head and the drain thread
+// is the only writer of tail, so no locks are needed. A full ring drops
+// new records instead of waiting.
+struct LogRing {
+    static constexpr size_t SIZE = 1024;
+
+    alignas(64) std::atomic<size_t> head = 0;
+    alignas(64) std::atomic<size_t> tail = 0;
+    std::atomic<size_t> dropped = 0;
+    std::atomic<bool> finished = false; // the thread has exited
+    size_t number = 0;                  // of the thread in the log
+    std::array<LogRecord, SIZE> records;
+};
+
+//--------------------------------------------------------------
+// class Logger
+//
+// Every thread writes records into its own ring, a background thread
+// (started by the first record) formats them into the output stream.
+// Messages of a thread keep their order, messages of different threads
+// can be interleaved in any order. Flush() writes everything logged so
+// far, the destructor flushes too.
+//--------------------------------------------------------------
+class Logger {
     std::ostream &output;
-    std::mutex mutex;
+
+    std::mutex mutex; // rings list and output
+    std::condition_variable wakeUp;
+    std::vector<std::shared_ptr<LogRing>> rings;
+    size_t numThreads = 0;
+    bool stopping = false;
+    std::thread drainThread;
+
+    LogRing &LocalRing();
+    void DrainLoop();
+    void DrainRings();
+    void Print(const LogRing &ring, const LogRecord &record);
+
+    template <typename T>
+    static void StoreArg(LogRecord &record, size_t i, T value) {
+        if constexpr (std::is_pointer_v<T>) {
+            record.argType[i] = 'p';
+            record.args[i] = reinterpret_cast<uintptr_t>(value);
+        } else {
+            static_assert(std::is_integral_v<T> || std::is_enum_v<T>,
+                          "only integers and pointers can be logged");
+            record.argType[i] = std::is_signed_v<T> ? 'i' : 'u';
+            record.args[i] = static_cast<uint64_t>(value);
+        }
+    }
 
   public:
     explicit Logger(std::ostream &str);
+    Logger(const Logger &) = delete;
+    Logger &operator=(const Logger &) = delete;
+    ~Logger();
+
+    template <typename... Args>
+    void Write(LogLevel level, const char *file, unsigned line,
+               const char *format, Args... args) {
+        static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many arguments");
+        LogRing &ring = LocalRing();
+        size_t head = ring.head.load(std::memory_order_relaxed);
+        size_t tail = ring.tail.load(std::memory_order_acquire);
+        if (head - tail == LogRing::SIZE) {
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        LogRecord &record = ring.records[head % LogRing::SIZE];
+        record.format = format;
+        record.file = file;
+        record.line = line;
+        record.level = level;
+        record.numArgs = sizeof...(Args);
+        [[maybe_unused]] size_t i = 0;
+        (StoreArg(record, i++, args), ...);
+        ring.head.store(head + 1, std::memory_order_release);
+    }
 
     void Flush();
-    void Lock();
-    void Unlock();
 };
 
 extern Logger logger;
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace utils {
+//--------------------------------------------------------------
+// A counter which is updated often by many threads and read
+// rarely (statistics). It's split into shards on separate cache
+// lines and a thread always updates its own shard, so updates of
+// different threads don't move one cache line between cores.
+// Threads get shards round robin on their first update, more
+// threads than shards share them. Reading sums all shards: the
+// sum is exact when nobody updates the counter, otherwise it's
+// a value the counter had at some moment during the read at best.
+//--------------------------------------------------------------
+constexpr size_t COUNTER_SHARDS = 16;
+
+inline std::atomic<size_t> nextCounterShard = 0;
+
+// Index of the shard of the calling thread
+inline size_t CounterShard() {
+    static thread_local size_t shard = nextCounterShard++ % COUNTER_SHARDS;
+    return shard;
+}
+
+class ShardedCounter {
+    // a shard can go below zero if another thread increments
+    // the counter and this one decrements it
+    struct alignas(64) Shard {
+        std::atomic<int64_t> value = 0;
+    };
+    std::array<Shard, COUNTER_SHARDS> shards;
+
+    void add(int64_t delta) {
+        shards[CounterShard()].value.fetch_add(delta,
+                                               std::memory_order_relaxed);
+    }
+
+  public:
+    ShardedCounter() = default;
+    ShardedCounter(const ShardedCounter &) = delete;
+    ShardedCounter &operator=(const ShardedCounter &) = delete;
+
+    void operator++(int) { add(1); }
+    void operator--(int) { add(-1); }
+    void operator+=(size_t delta) { add(static_cast<int64_t>(delta)); }
+    void operator-=(size_t delta) { add(-static_cast<int64_t>(delta)); }
+
+    size_t load() const {
+        int64_t sum = 0;
+        for (const Shard &shard : shards)
+            sum += shard.value.load(std::memory_order_relaxed);
+        return sum > 0 ? static_cast<size_t>(sum) : 0;
+    }
+    operator size_t() const { return load(); }
+};
+
+} // namespace utils
@@ -0,0 +1,105 @@
+#include <cassert>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "thread_pool.hpp"
+
+namespace utils {
+//--------------------------------------------------------------
+// Fixed size thread pool with work stealing
+//--------------------------------------------------------------
+WorkStealingPool::WorkStealingPool(size_t numWorkers) {
+    assert(numWorkers > 0);
+    for (size_t i = 0; i < numWorkers; ++i) {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (size_t i = 0; i < numWorkers; ++i) {
+        workers.emplace_back(&WorkStealingPool::WorkerLoop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    Wait();
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stopped = true;
+    }
+    taskAdded.notify_all();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+void WorkStealingPool::Submit(std::function<void()> task) {
+    // new tasks are spread between workers round-robin,
+    // stealing takes care of the imbalance
+    size_t worker = nextQueue++ % queues.size();
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        ++pending;
+        ++queued;
+    }
+    {
+        std::lock_guard<std::mutex> guard(queues[worker]->mutex);
+        queues[worker]->tasks.push_back(std::move(task));
+    }
+    taskAdded.notify_one();
+}
+
+void WorkStealingPool::Wait() {
+    std::unique_lock<std::mutex> ul(mutex);
+    allDone.wait(ul, [this]() { return pending == 0; });
+}
+
+size_t WorkStealingPool::NumWorkers() const { return workers.size(); }
+
+bool WorkStealingPool::TryTake(size_t worker, std::function<void()> &task) {
+    {
+        WorkerQueue &own = *queues[worker];
+        std::lock_guard<std::mutex> guard(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues.size(); ++i) {
+        WorkerQueue &victim = *queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::WorkerLoop(size_t worker) {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> ul(mutex);
+            taskAdded.wait(ul, [this]() { return stopped || queued > 0; });
+            if (stopped)
+                return;
+        }
+
+        std::function<void()> task;
+        if (!TryTake(worker, task))
+            continue; // somebody else was faster
+
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            --queued;
+        }
+        task();
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            if (--pending == 0)
+                allDone.notify_all();
+        }
+    }
+}
+
+} // namespace utils
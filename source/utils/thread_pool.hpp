@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace utils {
+//--------------------------------------------------------------
+// Fixed size thread pool with work stealing. Each worker takes
+// tasks from the back of its own queue and steals from the front
+// of other queues when its own queue is empty.
+//--------------------------------------------------------------
+class WorkStealingPool {
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> nextQueue = 0;
+
+    std::mutex mutex;
+    std::condition_variable taskAdded;
+    std::condition_variable allDone;
+    size_t pending = 0; // submitted but not finished tasks
+    size_t queued = 0;  // submitted but not started tasks
+    bool stopped = false;
+
+    bool TryTake(size_t worker, std::function<void()> &task);
+    void WorkerLoop(size_t worker);
+
+  public:
+    explicit WorkStealingPool(size_t numWorkers);
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+    ~WorkStealingPool();
+
+    void Submit(std::function<void()> task);
+    void Wait(); // until all submitted tasks are finished
+    size_t NumWorkers() const;
+};
+
+} // namespace utils
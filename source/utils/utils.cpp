@@ -1,5 +1,7 @@
 #include <fstream>
+#include <map>
 #include <sstream>
+#include <string>
 
 #include "table.hpp"
 #include "utils.hpp"
@@ -86,6 +88,31 @@ size_t CheckArgsAndGetMemorySize(int argc, char **argv) {
         std::cout << "This program needs an integer argument." << std::endl;
         std::cout << "Usage: " << std::endl;
         std::cout << "\t" << argv[0] << " [Limit size of RAM to use in Mb]"
+                  << " [options]" << std::endl;
+        std::cout << "Options:" << std::endl;
+        std::cout << "\t--mode=pool|per-file|single|partitioned|compare "
+                     "(default: pool)"
+                  << std::endl;
+        std::cout << "\t--workers=N  threads of the pool mode (default: "
+                     "number of cores)"
+                  << std::endl;
+        std::cout << "\t--arenas=N  copy files by N independent memory "
+                     "managers"
+                  << std::endl;
+        std::cout << "\t--stats-file=PATH  publish statistics for memmgr_top"
+                  << std::endl;
+        std::cout << "\t--tenant-quota=KB[:KB]  copy every file as a tenant "
+                     "with this RAM reservation and limit"
+                  << std::endl;
+        std::cout << "\t--direct-io=0|1  O_DIRECT for swap files (default: 0)"
+                  << std::endl;
+        std::cout << "\t--checksums=0|1  CRC32C of swapped blocks (default: 0)"
+                  << std::endl;
+        std::cout << "\t--verify=0|1  compare checksums of input and output "
+                     "files (default: 1)"
+                  << std::endl;
+        std::cout << "\t--swap-tiers=DIR[+DIR...][:MB],...  swap tiers from the "
+                     "fastest to the slowest"
                   << std::endl;
         exit(1);
     }
@@ -100,6 +127,26 @@ size_t CheckArgsAndGetMemorySize(int argc, char **argv) {
     return memorySizeMb;
 }
 
+// Optional arguments in the form --name=value or just --name
+std::map<std::string, std::string> ParseOptions(int argc, char **argv,
+                                                int first) {
+    std::map<std::string, std::string> options;
+    for (int i = first; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) {
+            std::cout << "Unknown argument '" << arg << "'" << std::endl;
+            exit(1);
+        }
+        size_t eq = arg.find('=');
+        if (eq == std::string::npos) {
+            options[arg.substr(2)] = "";
+        } else {
+            options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+        }
+    }
+    return options;
+}
+
 void ClearConsole() { system("@cls||clear"); }
 
 } // namespace utils
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <map>
 #include <sstream>
+#include <string>
 
 #include "table.hpp"
 #include "timer.hpp"
@@ -57,6 +58,8 @@ struct HumanReadable {
 //--------------------------------------------------------------
 size_t FileSize(std::ifstream &fin);
 size_t CheckArgsAndGetMemorySize(int argc, char **argv);
+std::map<std::string, std::string> ParseOptions(int argc, char **argv,
+                                                int first);
 void CheckIfDirectoryExists(const fs::path &dir);
 void CreateDirectoryIfNotExists(const fs::path &dir);
 void ShowProgress(
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace utils {
+//--------------------------------------------------------------
+// Allocator for big tables which are filled with zeros and then
+// used piece by piece. Memory comes from calloc(), which takes
+// big blocks straight from the kernel as zero pages, and
+// value-initialization of elements is skipped, so a page of the
+// table gets into RSS only when an element on it is written.
+// Zero bytes must be a valid value of T.
+//--------------------------------------------------------------
+template <typename T> struct ZeroedAllocator {
+    using value_type = T;
+
+    ZeroedAllocator() = default;
+    template <typename U> ZeroedAllocator(const ZeroedAllocator<U> &) {}
+
+    T *allocate(size_t count) {
+        void *ptr = std::calloc(count, sizeof(T));
+        if (!ptr)
+            throw std::bad_alloc();
+        return static_cast<T *>(ptr);
+    }
+    void deallocate(T *ptr, size_t) { std::free(ptr); }
+
+    // the element is zero already
+    template <typename U> void construct(U *) {
+        static_assert(std::is_trivially_default_constructible_v<U>);
+    }
+    template <typename U, typename... Args>
+    void construct(U *ptr, Args &&...args) {
+        ::new (static_cast<void *>(ptr)) U(std::forward<Args>(args)...);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const ZeroedAllocator<T> &, const ZeroedAllocator<U> &) {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const ZeroedAllocator<T> &, const ZeroedAllocator<U> &) {
+    return false;
+}
+
+// zero-filled table, see ZeroedAllocator
+template <typename T> using ZeroedVector = std::vector<T, ZeroedAllocator<T>>;
+} // namespace utils